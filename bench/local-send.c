@@ -0,0 +1,90 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * This software is licensed under the stock MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Same thread send benchmark. MT_Send to an object on the current thread
+ * calls it directly, so this measures the cost of the send path itself,
+ * mostly the lookup of the current message queue.
+ *
+ * Usage: local-send [sends]
+ *
+ * It is a standalone program to be built and linked against the library.
+ */
+
+#include <mt/message.h>
+#include <mt/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct Target Target;
+
+struct Target {
+    MT_Object       obj;
+    long            received;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void OnMessage(Target* t, const int* v)
+{
+    t->received += v[0];
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char** argv)
+{
+    long sends = argc > 1 ? atol(argv[1]) : 100000000;
+    MT_Pipe(int) pipe;
+    MT_Time start, end;
+    Target t;
+    long i;
+
+    /* Arguments are copied in multiples of 8 bytes */
+    int v[2] = {1, 0};
+
+    MT_InitObject(&t.obj);
+    t.received = 0;
+    MT_InitPipe(int, &pipe);
+    MT_SetPipe(&pipe, &OnMessage, &t);
+
+    start = MT_MonotonicTime();
+
+    for (i = 0; i < sends; i++) {
+        MT_Send(&pipe, v);
+    }
+
+    end = MT_MonotonicTime();
+
+    printf("%ld sends: %.3f s %.2f ns/send\n",
+            t.received,
+            MT_TIME_TO_SECONDS(end - start),
+            MT_TIME_TO_SECONDS(end - start) * 1e9 / sends);
+
+    MT_DestroyPipe(&pipe);
+    MT_DestroyObject(&t.obj);
+    return 0;
+}
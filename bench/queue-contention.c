@@ -0,0 +1,159 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * This software is licensed under the stock MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Message queue contention benchmark. 1 to 32 producer threads send ints to
+ * a single consumer running the event loop on the main thread, and the
+ * consumer's throughput is reported for each producer count.
+ *
+ * Usage: queue-contention [messages per run] [ring size]
+ *
+ * A ring size of 0 (the default) uses the linked list queue only, otherwise
+ * the consumer's queue is created with MT_NewMessageQueue2. It is a
+ * standalone program to be built and linked against the library.
+ */
+
+#include <mt/message.h>
+#include <mt/thread.h>
+#include <mt/lock.h>
+#include <mt/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_PRODUCERS 32
+
+typedef struct Consumer Consumer;
+typedef struct Producer Producer;
+
+struct Consumer {
+    MT_Object       obj;
+    long            received;
+    long            expected;
+};
+
+struct Producer {
+    MT_Thread*      thread;
+    MT_Pipe(int)    pipe;
+    long            count;
+};
+
+/* Held by the consumer until every producer has been created */
+static MT_Mutex g_start = MT_MUTEX_INITIALIZER;
+
+/* ------------------------------------------------------------------------- */
+
+static void OnMessage(Consumer* c, const int* v)
+{
+    (void) v;
+
+    if (++c->received == c->expected) {
+        MT_ExitEventLoop();
+    }
+}
+
+static int Produce(Producer* p)
+{
+    long i;
+
+    /* Arguments are copied in multiples of 8 bytes */
+    int v[2] = {0, 0};
+
+    /* Start together so thread creation isn't part of the timing */
+    MT_Lock(&g_start);
+    MT_Unlock(&g_start);
+
+    for (i = 0; i < p->count; i++) {
+        MT_Send(&p->pipe, v);
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void Run(Consumer* c, int producers, long messages)
+{
+    Producer p[MAX_PRODUCERS];
+    MT_Time start, end;
+    double secs;
+    int i;
+
+    c->received = 0;
+    c->expected = (messages / producers) * producers;
+
+    MT_Lock(&g_start);
+
+    for (i = 0; i < producers; i++) {
+        p[i].thread = MT_NewThread("producer %d", i);
+        p[i].count = messages / producers;
+        MT_InitPipe(int, &p[i].pipe);
+        MT_SetPipe(&p[i].pipe, &OnMessage, c);
+        MT_StartThread(p[i].thread, BindInt(&Produce, &p[i]));
+    }
+
+    start = MT_MonotonicTime();
+    MT_Unlock(&g_start);
+    MT_RunEventLoop();
+    end = MT_MonotonicTime();
+
+    for (i = 0; i < producers; i++) {
+        MT_FreeThread(p[i].thread);
+        MT_DestroyPipe(&p[i].pipe);
+    }
+
+    secs = MT_TIME_TO_SECONDS(end - start);
+
+    printf("%2d producers: %8.3f s %8.2f M msg/s %8.1f ns/msg\n",
+            producers,
+            secs,
+            c->expected / secs / 1e6,
+            secs * 1e9 / c->expected);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char** argv)
+{
+    long messages = argc > 1 ? atol(argv[1]) : 1000000;
+    int ring = argc > 2 ? atoi(argv[2]) : 0;
+    MT_MessageQueue* q = ring > 0 ? MT_NewMessageQueue2(ring) : MT_NewMessageQueue();
+    Consumer c;
+    int producers;
+
+    MT_SetCurrentMessageQueue(q);
+    MT_InitObject(&c.obj);
+
+    printf("%ld messages per run, ring size %d\n", messages, ring);
+
+    for (producers = 1; producers <= MAX_PRODUCERS; producers *= 2) {
+        Run(&c, producers, messages);
+    }
+
+    MT_DestroyObject(&c.obj);
+    MT_SetCurrentMessageQueue(NULL);
+    MT_FreeMessageQueue(q);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * This software is licensed under the stock MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+/* Signal fan out benchmark. The main thread emits an int signal connected to
+ * targets objects on each of threads receiver threads, and the time for all
+ * of the emits to be delivered is reported.
+ *
+ * Usage: signal-fanout [emits] [threads] [targets] [batch]
+ *
+ * The defaults are 100000 emits to 2 threads with 50 targets each. With a
+ * batch size the emits are made inside MT_BeginBatch/MT_FlushBatch blocks
+ * of that many. It is a standalone program to be built and linked against
+ * the library.
+ */
+
+#include <mt/message.h>
+#include <mt/thread.h>
+#include <mt/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct Target Target;
+typedef struct Receiver Receiver;
+
+struct Target {
+    MT_Object       obj;
+    Receiver*       receiver;
+};
+
+struct Receiver {
+    MT_Thread*      thread;
+    Target*         targets;
+    int             target_num;
+    long            received;
+    long            expected;
+};
+
+static MT_Signal(int) g_signal;
+
+/* Receivers report back to the main thread once they have everything */
+static MT_Object g_main;
+static MT_Pipe(int) g_done;
+static int g_done_num;
+
+/* ------------------------------------------------------------------------- */
+
+static void OnEmit(Target* t, const int* v)
+{
+    Receiver* r = t->receiver;
+    (void) v;
+
+    if (++r->received == r->expected) {
+        int done[2] = {1, 0};
+        MT_Send(&g_done, done);
+        MT_ExitEventLoop();
+    }
+}
+
+static void OnDone(MT_Object* o, const int* v)
+{
+    (void) o;
+    (void) v;
+    g_done_num--;
+
+    if (g_done_num == 0) {
+        MT_ExitEventLoop();
+    }
+}
+
+static int Receive(Receiver* r)
+{
+    int i;
+
+    MT_RunEventLoop();
+
+    for (i = 0; i < r->target_num; i++) {
+        MT_DestroyObject(&r->targets[i].obj);
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char** argv)
+{
+    long emits = argc > 1 ? atol(argv[1]) : 100000;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    int targets = argc > 3 ? atoi(argv[3]) : 50;
+    int batch = argc > 4 ? atoi(argv[4]) : 0;
+    Receiver* r = (Receiver*) calloc(threads, sizeof(Receiver));
+    MT_Time start, end;
+    long i;
+    int j, k;
+
+    MT_InitSignal(int, &g_signal);
+    MT_InitObject(&g_main);
+    MT_InitPipe(int, &g_done);
+    MT_SetPipe(&g_done, &OnDone, &g_main);
+    g_done_num = threads;
+
+    for (j = 0; j < threads; j++) {
+        r[j].thread = MT_NewThread("receiver %d", j);
+        r[j].targets = (Target*) calloc(targets, sizeof(Target));
+        r[j].target_num = targets;
+        r[j].expected = emits * targets;
+
+        /* Create the targets on the receiver thread */
+        MT_BeginThreadInit(r[j].thread);
+
+        for (k = 0; k < targets; k++) {
+            r[j].targets[k].receiver = &r[j];
+            MT_InitObject(&r[j].targets[k].obj);
+            MT_Connect(&g_signal, &OnEmit, &r[j].targets[k]);
+        }
+
+        MT_EndThreadInit(r[j].thread);
+        MT_StartThread(r[j].thread, BindInt(&Receive, &r[j]));
+    }
+
+    start = MT_MonotonicTime();
+
+    for (i = 0; i < emits; i++) {
+        /* Arguments are copied in multiples of 8 bytes */
+        int v[2];
+        v[0] = (int) i;
+        v[1] = 0;
+
+        if (batch > 0 && i % batch == 0) {
+            MT_BeginBatch();
+        }
+
+        MT_Emit(&g_signal, v);
+
+        if (batch > 0 && (i % batch == batch - 1 || i == emits - 1)) {
+            MT_FlushBatch();
+        }
+    }
+
+    MT_RunEventLoop();
+    end = MT_MonotonicTime();
+
+    printf("%ld emits to %d threads x %d targets, batch %d: %.3f s\n",
+            emits, threads, targets, batch,
+            MT_TIME_TO_SECONDS(end - start));
+
+    for (j = 0; j < threads; j++) {
+        MT_FreeThread(r[j].thread);
+        free(r[j].targets);
+    }
+
+    MT_DestroyPipe(&g_done);
+    MT_DestroyObject(&g_main);
+    MT_DestroySignal(&g_signal);
+    free(r);
+    return 0;
+}
@@ -101,6 +101,13 @@ MT_INLINE long MT_AtomicSubtract(MT_AtomicInt* a, long decr)
     return MT_AtomicAdd(a, -decr);
 }
 
+/* Full memory barrier */
+MT_INLINE void MT_MemoryBarrier(void)
+{
+    long barrier = 0;
+    _InterlockedExchange(&barrier, 1);
+}
+
 #elif defined __GNUC__
 
 /* Returns previous value */
@@ -153,6 +160,12 @@ MT_INLINE long MT_AtomicSubtract(MT_AtomicInt* a, long decr)
     return __sync_sub_and_fetch(a, decr);
 }
 
+/* Full memory barrier */
+MT_INLINE void MT_MemoryBarrier(void)
+{
+    __sync_synchronize();
+}
+
 #else
 #error
 #endif
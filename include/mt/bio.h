@@ -43,17 +43,68 @@
 struct MT_BufferedIO {
     VoidDelegate    on_close;
     SliceDelegate   on_rx;
+
+    /* Called when the TX queue goes over the high watermark and when it
+     * drops back down to the low watermark (see MT_SetWriteWatermarks).
+     * They are called from the event loop rather than from within the send
+     * or flush that changed the state, so they may free the IO.
+     */
+    VoidDelegate    on_full;
+    VoidDelegate    on_drain;
 };
 
 #define MT_CLOSE_SOCKET_ON_FREE   0x01
 #define MT_SERVER_BIO             0x02
 
+/* Uses edge triggered read notifications (see MT_EVENT_EDGE) and reads until
+ * the socket is drained. This avoids being woken for the same data again
+ * whilst busy peers are streaming. TLS sockets are always level triggered.
+ */
+#define MT_EDGE_TRIGGERED         0x04
+
 MT_API void MT_CloseBufferedIO(MT_BufferedIO* io);
 MT_API void MT_FreeBufferedIO(MT_BufferedIO* io);
+/* Queues the contents of a file or named pipe. The file is streamed from
+ * disk as the socket drains rather than being read into memory up front.
+ * Files are sent with sendfile and pipes with splice where available.
+ */
 MT_API bool MT_SendFile(MT_BufferedIO* io, d_Slice(char) filename);
+
+/* Copies data onto the end of the TX queue. Consecutive small sends are
+ * coalesced into the same buffer.
+ */
 MT_API int MT_SendData(MT_BufferedIO* io, d_Slice(char) data);
+
+/* Queues data without copying it. The data must stay valid until release is
+ * called, which happens once it has all been sent or the IO is freed.
+ * release may be a NULL delegate. It must not free the IO.
+ */
+MT_API int MT_SendDataRef(MT_BufferedIO* io, d_Slice(char) data, VoidDelegate release);
+
+/* Returns size bytes at the end of the TX queue for the caller to fill in */
 MT_API char* MT_GetSendBuffer(MT_BufferedIO* io, int size);
 
+/* Sets the TX queue watermarks in bytes. Data held in memory for sending is
+ * counted, files queued with MT_SendFile are not. Sends are never refused, so
+ * producers should stop on on_full or when MT_IsWriteFull returns true and
+ * resume on on_drain. A high watermark of 0 disables them (the default).
+ */
+MT_API void MT_SetWriteWatermarks(MT_BufferedIO* io, int low, int high);
+MT_API bool MT_IsWriteFull(MT_BufferedIO* io);
+
+/* Stops reading from rx whilst the TX queue of io is full. This is for
+ * proxies forwarding from rx to io, so that a slow reader on one side
+ * pushes back on the writer on the other. An IO can only be paused by one
+ * other IO at a time. Pass NULL to remove.
+ */
+MT_API void MT_SetFlowControl(MT_BufferedIO* io, MT_BufferedIO* rx);
+
+/* Limits the number of bytes read from the socket for each read
+ * notification, after which we yield to the rest of the event loop and
+ * carry on in the next batch. The default is 256KB. 0 removes the limit.
+ */
+MT_API void MT_SetReadBudget(MT_BufferedIO* io, int bytes);
+
 MT_API MT_BufferedIO* MT_NewBufferedSocket(MT_Socket sock, int flags);
 MT_API MT_BufferedIO* MT_NewBufferedSSL(MT_Socket sock, SSL_CTX* ctx, int flags);
 MT_API void MT_SetupKeepalive(MT_BufferedIO* io, MT_Time timeout, d_Slice(char) data);
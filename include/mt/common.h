@@ -68,6 +68,14 @@
 
 
 
+/* Data written by different threads is padded out and aligned to this size
+ * so that it doesn't share a cache line. It can be overridden when
+ * building for targets with a different line size.
+ */
+#ifndef MT_CACHE_LINE_SIZE
+#define MT_CACHE_LINE_SIZE 64
+#endif
+
 #define MT_NOT_COPYABLE(c) private: c(c& __DummyArg); c& operator=(c& __DummyArg)
 
 #ifndef container_of
@@ -100,10 +108,12 @@ typedef struct MT_Process           MT_Process;
 typedef struct MT_Publisher         MT_Publisher;
 typedef struct MT_Reply             MT_Reply;
 typedef struct MT_Request           MT_Request;
+typedef struct MT_Server            MT_Server;
 typedef struct MT_Sockaddr          MT_Sockaddr;
 typedef struct MT_Object            MT_Object;
 typedef struct MT_WeakData          MT_WeakData;
 typedef struct MT_Thread            MT_Thread;
+typedef struct MT_ThreadPool        MT_ThreadPool;
 typedef struct MT_ThreadStorage     MT_ThreadStorage;
 
 typedef struct MTI_DelegateVector   MTI_DelegateVector;
@@ -37,6 +37,13 @@ MT_API MT_Event* MT_NewHandleEvent(MT_Handle h, VoidDelegate cb);
 MT_API MT_Event* MT_NewIdleEvent(VoidDelegate cb);
 MT_API MT_Event* MT_NewTickEvent(MT_Time period, VoidDelegate cb);
 
+/* Timeout events fire once when the loop time (see MT_LoopTime) reaches the
+ * deadline and are then disabled. Enabling it again with MT_EVENT_TICK
+ * rearms it with the same deadline. The event still has to be freed with
+ * MT_FreeEvent.
+ */
+MT_API MT_Event* MT_NewTimeoutEvent(MT_Time deadline, VoidDelegate cb);
+
 /* Available flags for MT_EnableEvent */
 #define MT_EVENT_HANDLE  0x01
 #define MT_EVENT_READ    0x02
@@ -46,6 +53,13 @@ MT_API MT_Event* MT_NewTickEvent(MT_Time period, VoidDelegate cb);
 #define MT_EVENT_IDLE    0x20
 #define MT_EVENT_TICK    0x40
 
+/* Switches a socket event to edge triggered notifications where the OS
+ * supports it (epoll). The read callback is then only called again once new
+ * data arrives so it must read until the socket would block. This is ignored
+ * by the other backends which stay level triggered.
+ */
+#define MT_EVENT_EDGE    0x80
+
 /* Note these events can be either level or edge triggered so the calling code
  * should only enable the event when it needs it (eg only enable the write
  * event when a call to send failed) and process all data available when the
@@ -56,4 +70,19 @@ MT_API MT_Event* MT_NewTickEvent(MT_Time period, VoidDelegate cb);
 MT_API void MT_EnableEvent(MT_Event* r, int flags);
 MT_API void MT_DisableEvent(MT_Event* r, int flags);
 MT_API void MT_ResetEvent(MT_Event* r);
+
+/* Asks an edge triggered socket event to be notified again if the socket is
+ * still ready, eg after stopping early with data left to read. Events that
+ * are already pending are kept. This does nothing for level triggered
+ * events, which are notified again anyway.
+ */
+MT_API void MT_RearmEvent(MT_Event* r);
 MT_API void MT_FreeEvent(MT_Event* r);
+
+/* Returns the time the current batch of event loop callbacks started. This
+ * is the time ticks and timeouts are scheduled against. It uses the same
+ * monotonic base as MT_MonotonicTime so is unaffected by changes to the
+ * system clock, is cheaper to call, but does not advance whilst a callback
+ * is running.
+ */
+MT_API MT_Time MT_LoopTime(void);
@@ -64,10 +64,27 @@ MT_API MT_MessageQueue* MT_CurrentMessageQueue(void);
 MT_API void MT_SetCurrentMessageQueue(MT_MessageQueue* s);
 
 MT_API MT_MessageQueue* MT_NewMessageQueue(void);
+
+/* If ring_size is greater than 0 the queue also gets a bounded ring of at
+ * least ring_size slots. Sends to the queue from other threads then copy
+ * small arguments straight into the ring instead of allocating a message.
+ * If the ring is full sends fall back to the unbounded queue, whilst
+ * MT_TrySend fails so that the producer can back off.
+ */
+MT_API MT_MessageQueue* MT_NewMessageQueue2(int ring_size);
 MT_API void MT_FreeMessageQueue(MT_MessageQueue* s);
 MT_API void MT_ProcessMessageQueue(MT_MessageQueue* s);
 MT_API void MT_SetMessageQueueWakeup(MT_MessageQueue* s, VoidDelegate wakeup);
 
+/* Between MT_BeginBatch and MT_FlushBatch messages sent from this thread to
+ * other queues are held back. On the flush they are published with a single
+ * atomic exchange and at most one wakeup per target queue. Messages stay in
+ * order per target. Batches can be nested in which case only the outermost
+ * flush publishes.
+ */
+MT_API void MT_BeginBatch(void);
+MT_API void MT_FlushBatch(void);
+
 /* ------------------------------------------------------------------------- */
 
 /* Operations on objects */
@@ -128,8 +145,15 @@ MT_API bool MT_IsSynchronous(MT_WeakData* s);
     } while(0)
 
 
+/* MT_TrySend is the same as MT_Send except that it returns false instead of
+ * queueing the message if the target's message queue has a ring (see
+ * MT_NewMessageQueue2) which is full.
+ */
+#define MT_TrySend(PCH, PDATA)      (MT_CheckChData(PCH, PDATA), MT_BaseTrySend(PCH, PDATA))
+
 MT_API void MT_BaseSend(const void* channel, const void* argument);
 MT_API void MT_BaseSendProxied(const void* channel, const void* argument);
+MT_API bool MT_BaseTrySend(const void* channel, const void* argument);
 
 /* ------------------------------------------------------------------------- */
 
@@ -0,0 +1,73 @@
+/* vim: ts=4 sw=4 sts=4 et tw=78
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * This software is licensed under the stock MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+
+#pragma once
+
+#include <mt/common.h>
+#include <dmem/char.h>
+
+/* ------------------------------------------------------------------------- */
+
+/* Multi reactor TCP server. Each loop is an MT_Thread running its own event
+ * loop with its own listening socket bound with MT_SOCKET_REUSEPORT, so the
+ * kernel spreads new connections between the loops and accepted sockets
+ * are serviced on the loop that accepted them. Without SO_REUSEPORT
+ * (eg on windows) the server runs a single loop.
+ */
+
+/* Called on the loop thread with each accepted socket. The handler takes
+ * ownership of the socket. Once the loop stops, or if the server fails to
+ * start, it is called a last time with MT_SOCKET_INVALID so that it can free
+ * itself.
+ */
+DECLARE_DELEGATE_1(MT_AcceptDelegate, void, MT_Socket);
+#define MT_BindAccept(func, obj) BIND1(MT_AcceptDelegate, func, obj, MT_Socket*)
+
+/* Called once per loop with the loop index before the loop thread starts.
+ * It is called between MT_BeginThreadInit and MT_StartThread so objects
+ * created in it belong to the loop, and MT_CurrentThread returns the loop
+ * thread so its options (eg affinity) can be set. Returns the loop's accept
+ * handler.
+ */
+DECLARE_DELEGATE_1(MT_ServerInit, MT_AcceptDelegate, int);
+#define MT_BindServerInit(func, obj) BIND1(MT_ServerInit, func, obj, int*)
+
+/* Binds url on loops threads. If loops is <= 0 one loop per CPU is started.
+ * A port of 0 binds ephemeral ports on the first loop which the remaining
+ * loops then share, per address family. Returns NULL if any loop fails to
+ * bind.
+ */
+MT_API MT_Server* MT_NewServer(d_Slice(char) url, int loops, MT_ServerInit init);
+
+/* Stops and joins the loop threads and closes the listening sockets */
+MT_API void MT_FreeServer(MT_Server* s);
+
+MT_API int MT_ServerLoopCount(MT_Server* s);
+MT_API MT_Thread* MT_ServerThread(MT_Server* s, int loop);
+MT_API MT_Socket MT_ServerSocket(MT_Server* s, int loop);
+
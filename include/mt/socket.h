@@ -57,6 +57,12 @@ struct MT_Sockaddr {
 #define MT_SOCKET_REUSEADDR 1
 #define MT_SOCKET_LISTEN    2
 
+/* Allows multiple sockets to bind the same address with the kernel spreading
+ * incoming connections between them (SO_REUSEPORT). Sockets fail to bind
+ * with this flag where it isn't supported.
+ */
+#define MT_SOCKET_REUSEPORT 4
+
 DVECTOR_INIT(MT_Socket, MT_Socket);
 
 /* Url is a string of the form <hostname>:<port> */
@@ -0,0 +1,70 @@
+/* vim: ts=4 sw=4 sts=4 et tw=78
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * This software is licensed under the stock MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+
+#pragma once
+
+#include <mt/common.h>
+#include <mt/message.h>
+
+/* ------------------------------------------------------------------------- */
+
+/* Pool of worker threads for CPU bound jobs (encoding, compression, etc) that
+ * would otherwise block an event loop. Each worker keeps its jobs in a work
+ * stealing deque. Idle workers steal from the busy ones and jobs submitted
+ * from outside the pool are shared out through a common inbox.
+ *
+ * When a job has run, its argument is sent down the completion pipe with
+ * MT_Send from the worker, so the completion callback runs on the pipe
+ * target's message queue. A pipe whose target has been destroyed in the
+ * meantime is ignored as with any other send.
+ *
+ * Jobs run on the worker threads and so should only touch data owned by the
+ * job. They should not create objects or events as the workers do not run
+ * an event loop.
+ */
+
+/* Starts the given number of worker threads or one per CPU if workers <= 0 */
+MT_API MT_ThreadPool* MT_NewThreadPool(int workers);
+
+/* Runs any jobs still queued and then joins the workers. Must not be called
+ * from a job.
+ */
+MT_API void MT_FreeThreadPool(MT_ThreadPool* s);
+
+/* Queues work to be run on the pool. Once it has returned the argument is
+ * sent down the pipe. The pipe is copied but the argument is only copied
+ * when the completion is sent, so it must stay valid until then (normally
+ * it points into the job). The pipe may be NULL if no completion is needed.
+ *
+ * Submitting from within a job pushes the new job onto the current worker's
+ * deque.
+ */
+MT_API void MT_BaseSubmit(MT_ThreadPool* s, VoidDelegate work, const void* pipe, const void* argument);
+
+#define MT_Submit(POOL, WORK, PCH, PDATA) (MT_BaseSubmit(POOL, WORK, PCH, PDATA), MT_CheckChData(PCH, PDATA))
+
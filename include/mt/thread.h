@@ -56,14 +56,75 @@ MT_API void MT_StartThread(MT_Thread* s, IntDelegate call);
 MT_API void MT_ExitThread(MT_Thread* s);
 MT_API void MT_SetThreadName(MT_Thread* s, const char* name);
 
+/* Returns the thread being initialised between MT_BeginThreadInit and
+ * MT_EndThreadInit, the thread we are running on if it is an MT_Thread,
+ * or NULL otherwise.
+ */
+MT_API MT_Thread* MT_CurrentThread(void);
+
+/* ------------------------------------------------------------------------- */
+
+/* Thread options. These must be set before the thread is started. The stack
+ * size is used to create the thread and the rest are applied on the new
+ * thread before the start delegate is called. Options the OS doesn't
+ * support or refuses (eg real time scheduling without the privileges for
+ * it) are logged and otherwise ignored.
+ */
+
+enum MT_ThreadPolicy {
+    MT_THREAD_INHERIT,      /* Leave the scheduling as the OS creates it */
+    MT_THREAD_NORMAL,       /* Time sharing, the priority is unused */
+    MT_THREAD_FIFO,         /* Real time, first in first out */
+    MT_THREAD_ROUND_ROBIN   /* Real time, round robin */
+};
+
+typedef enum MT_ThreadPolicy MT_ThreadPolicy;
+
+/* 0 uses the OS default */
+MT_API void MT_SetThreadStackSize(MT_Thread* s, size_t bytes);
+
+/* Restricts the thread to the num CPUs listed in cpus. On windows only the
+ * first 64 CPUs can be used.
+ */
+MT_API void MT_SetThreadAffinity(MT_Thread* s, const int* cpus, int num);
+
+/* On windows the policy is ignored and the priority is passed to
+ * SetThreadPriority.
+ */
+MT_API void MT_SetThreadScheduling(MT_Thread* s, MT_ThreadPolicy policy, int priority);
+
+/* Prefers memory from NUMA node for allocations made by the thread. If no
+ * affinity has been set the thread is also restricted to the node's CPUs.
+ * -1 (the default) leaves both to the OS.
+ */
+MT_API void MT_SetThreadNumaNode(MT_Thread* s, int node);
+
 /* ------------------------------------------------------------------------- */
 
 MT_API const char* MT_GetCurrentThreadName(void);
 
+/* The event loop dispatches up to max_batch callbacks for the events
+ * returned by each wait on the OS before waiting again. MT_RunEventLoop uses
+ * MT_EVENT_LOOP_BATCH. Lower values give fairer scheduling between sockets,
+ * higher values amortize the wait over more callbacks.
+ */
+#define MT_EVENT_LOOP_BATCH 64
+
 MT_API void MT_ExitEventLoop(void);
 MT_API void MT_RunEventLoop(void);
+MT_API void MT_RunEventLoop2(int max_batch);
 MT_API void MT_StepEventLoop(void);
 
+/* Before blocking in the OS wait the current thread's event loop can busy
+ * wait on its message queue for up to spins iterations. Whilst it spins,
+ * messages sent to it skip the wakeup event syscall. The spin is shortened
+ * whilst it keeps timing out and lengthened again when messages arrive
+ * during it. Sockets and ticks are not checked during the spin, but the OS
+ * is still polled after a spin that caught messages. 0 (the default)
+ * disables spinning, as does running on a single CPU.
+ */
+MT_API void MT_SetEventLoopSpin(int spins);
+
 /* ------------------------------------------------------------------------- */
 
 #define MT_THREAD_STORAGE_INITIALIZER {0, 0}
@@ -66,6 +66,22 @@ public:
         MT_SetThreadName(m_Thread, name);
     }
 
+    void SetStackSize(size_t bytes) {
+        MT_SetThreadStackSize(m_Thread, bytes);
+    }
+
+    void SetAffinity(const int* cpus, int num) {
+        MT_SetThreadAffinity(m_Thread, cpus, num);
+    }
+
+    void SetScheduling(MT_ThreadPolicy policy, int priority) {
+        MT_SetThreadScheduling(m_Thread, policy, priority);
+    }
+
+    void SetNumaNode(int node) {
+        MT_SetThreadNumaNode(m_Thread, node);
+    }
+
     template <class O>
     void Start(O* o) {
         MT_StartThread(m_Thread, BindInt(&RunThread<O>::Run, o));
@@ -82,6 +82,11 @@ MT_API void    MT_ToFileTime(MT_Time, FILETIME* ft);
 /* Current time in UTC */
 MT_API MT_Time MT_CurrentTime();
 
+/* Time in microseconds from an arbitrary fixed point that is not affected by
+ * changes to the system clock. Only useful for measuring intervals.
+ */
+MT_API MT_Time MT_MonotonicTime(void);
+
 /* These return ISO 8601 strings eg "2010-02-16" and "2010-02-16T22:00:08.067890Z" */
 MT_API void MT_DateString(d_Vector(char)* out, MT_Time t);
 MT_API void MT_TimeString(d_Vector(char)* out, MT_Time t);
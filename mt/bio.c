@@ -26,6 +26,9 @@
  */
 
 #define _POSIX_SOURCE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include "mt-internal.h"
 #include <mt/bio.h>
@@ -38,7 +41,18 @@
 
 #ifndef _WIN32
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#define MTI_USE_SENDFILE
 #endif
 
 #ifdef MT_USE_SSL
@@ -47,15 +61,115 @@
 
 #define BUFSZ (16 * 1024)
 
+/* Reads also fill a stack buffer of this size once the space at the end of
+ * rx_buf runs out. The overflow is then copied into rx_buf.
+ */
+#define MTI_RX_OVERFLOW (64 * 1024)
+
+/* rx_buf is shrunk back down to BUFSZ when it is emptied if it has grown
+ * beyond this.
+ */
+#define MTI_RX_KEEP (64 * 1024)
+
+/* Default for MT_SetReadBudget */
+#define MTI_RX_BUDGET (256 * 1024)
+
+/* Maximum number of TX segments flushed with a single writev */
+#define MTI_TX_IOVECS 64
+
+/* Size of the chunks that files are read in when they can't be sent straight
+ * from the kernel eg for TLS.
+ */
+#define MTI_TX_FILE_CHUNK (64 * 1024)
+
 typedef struct MTI_BufferedIO MTI_BufferedIO;
+typedef struct MTI_TxSegment MTI_TxSegment;
+
+/* The TX queue is a list of segments that are flushed together with writev.
+ * Copied segments own their data in buf and MT_SendData appends to the last
+ * one. Reference segments point at the caller's data and call release once
+ * it has been sent. File segments stream from an open file or pipe so that
+ * only a chunk at a time is held in memory.
+ */
+enum MTI_TxType {
+    MTI_TX_COPY,
+    MTI_TX_REF,
+    MTI_TX_FILE
+};
+
+struct MTI_TxSegment {
+    MTI_TxSegment*          next;
+    enum MTI_TxType         type;
+
+    /* Copied data or the chunk of a file that is currently being sent */
+    d_Vector(char)          buf;
+
+    d_Slice(char)           ref;
+    VoidDelegate            release;
+
+    /* Number of bytes at the start of buf or ref that have been sent */
+    int                     sent;
+
+#ifndef _WIN32
+    /* File segments. file_left is -1 for pipes which are read until EOF. */
+    int                     fd;
+    off_t                   file_offset;
+    int64_t                 file_left;
+
+    /* Waits for an empty pipe to become readable */
+    MT_Event*               pipe_reg;
+#endif
+};
 
 struct MTI_BufferedIO {
     MT_BufferedIO           h;
 
     VoidDelegate            free;
 
-    d_Vector(char)          tx_buf;
+    /* TX queue. tx_last is NULL when the queue is empty. The last copy
+     * segment may be empty.
+     */
+    MTI_TxSegment*          tx_first;
+    MTI_TxSegment*          tx_last;
+
+    /* Unsent bytes held in memory by the TX queue. This doesn't include
+     * file segments which are counted in tx_files.
+     */
+    int                     tx_size;
+    int                     tx_files;
+
+    /* Write watermarks (see MT_SetWriteWatermarks). tx_full is set when
+     * tx_size goes over tx_high and cleared when it drops to tx_low.
+     */
+    int                     tx_low;
+    int                     tx_high;
+    bool                    tx_full;
+
+    /* The tx_full state last reported through on_full/on_drain. These are
+     * called from the idle event when it differs from tx_full (see NotifyTx).
+     */
+    bool                    tx_notified;
+
+    /* Flow control (see MT_SetFlowControl). pause_rx is the IO whose reads
+     * are stopped whilst we are full and paused_by is the IO that stops
+     * ours.
+     */
+    MTI_BufferedIO*         pause_rx;
+    MTI_BufferedIO*         paused_by;
+    bool                    rx_paused;
+
+    /* A sent copy segment kept to reuse its buffer */
+    MTI_TxSegment*          tx_spare;
+
+    /* Received data that on_rx hasn't used yet is in rx_buf between
+     * rx_begin and rx_end. The size of rx_buf is the allocated space. Data is
+     * consumed by moving rx_begin and the buffer is only compacted when we
+     * run out of room at the end.
+     */
     d_Vector(char)          rx_buf;
+    int                     rx_begin;
+    int                     rx_end;
+
     d_Vector(char)          log;
     d_Vector(char)          keepalive_data;
 
@@ -66,6 +180,16 @@ struct MTI_BufferedIO {
     MT_Socket               sock;
     bool                    close_socket_on_free;
     bool                    is_server;
+    bool                    edge_triggered;
+
+    /* Most bytes read per read notification or 0 for no limit */
+    int                     rx_budget;
+
+    /* Set whilst the socket may still have data to read ie between a read
+     * notification and recv returning EAGAIN. An edge triggered registration
+     * is only rearmed while this is set.
+     */
+    bool                    rx_ready;
 
 #ifdef MT_USE_SSL
     SSL*                    ssl;
@@ -77,6 +201,7 @@ struct MTI_BufferedIO {
 static void Socket_Free(MTI_BufferedIO* s);
 static void Socket_ReadyRead(MTI_BufferedIO* s);
 static void Socket_OnIdle(MTI_BufferedIO* s);
+static void Socket_OnWrite(MTI_BufferedIO* s);
 static void Socket_Send(MTI_BufferedIO* s);
 static void KeepaliveTimeout(MTI_BufferedIO* s);
 
@@ -84,6 +209,7 @@ static void SSL_ReadyRead(MTI_BufferedIO* s);
 static void SSL_OnError(MTI_BufferedIO* s, int ret);
 static void SSL_Free(MTI_BufferedIO* s);
 static void SSL_OnIdle(MTI_BufferedIO* s);
+static void SSL_OnWrite(MTI_BufferedIO* s);
 static void SSL_Send(MTI_BufferedIO* s);
 static void SSL_MsgCallback(int write_p, int version, int content_type, const void* buf, size_t len, SSL* ssl, void* arg);
 
@@ -98,44 +224,419 @@ void MT_CloseBufferedIO(MT_BufferedIO* io)
 
 /* ------------------------------------------------------------------------- */
 
+static d_Slice(char) SegmentData(MTI_TxSegment* g)
+{
+    d_Slice(char) ret;
+
+    if (g->type == MTI_TX_REF) {
+        ret.data = g->ref.data + g->sent;
+        ret.size = g->ref.size - g->sent;
+    } else {
+        ret.data = g->buf.data + g->sent;
+        ret.size = g->buf.size - g->sent;
+    }
+
+    return ret;
+}
+
+static bool TxPending(MTI_BufferedIO* s)
+{
+    return s->tx_size > 0 || s->tx_files > 0;
+}
+
+static void PauseRx(MTI_BufferedIO* s, bool pause)
+{
+    if (s->rx_paused != pause) {
+        s->rx_paused = pause;
+
+        if (pause) {
+            MT_DisableEvent(s->sock_reg, MT_EVENT_READ);
+        } else {
+            MT_EnableEvent(s->sock_reg, MT_EVENT_READ);
+        }
+    }
+}
+
+/* The user callbacks for a change in tx_full are left to the idle event, as
+ * the change happens in the middle of sends and flushes which can't cope
+ * with the IO being freed under them.
+ */
+static void LatchTx(MTI_BufferedIO* s)
+{
+    if (s->tx_full != s->tx_notified) {
+        MT_EnableEvent(s->idle_reg, MT_EVENT_IDLE);
+    }
+}
+
+/* Calls on_full or on_drain if tx_full has changed since the last call.
+ * Returns true if it did, in which case the IO may have been freed and the
+ * caller must return straight away. The idle event has already had its turn
+ * this round, so the flush carries on from the write event.
+ */
+static bool NotifyTx(MTI_BufferedIO* s)
+{
+    VoidDelegate cb;
+
+    if (s->tx_full == s->tx_notified) {
+        return false;
+    }
+
+    s->tx_notified = s->tx_full;
+    cb = s->tx_full ? s->h.on_full : s->h.on_drain;
+
+    if (TxPending(s)) {
+        MT_EnableEvent(s->sock_reg, MT_EVENT_WRITE);
+    }
+
+    if (cb.func) {
+        CALL_DELEGATE_0(cb);
+    }
+
+    return true;
+}
+
+/* Called after adding to the TX queue */
+static void CheckFull(MTI_BufferedIO* s)
+{
+    if (s->tx_high > 0 && !s->tx_full && s->tx_size > s->tx_high) {
+        s->tx_full = true;
+
+        if (s->pause_rx) {
+            PauseRx(s->pause_rx, true);
+        }
+
+        LatchTx(s);
+    }
+}
+
+/* Called after removing from the TX queue */
+static void CheckDrained(MTI_BufferedIO* s)
+{
+    if (s->tx_full && s->tx_size <= s->tx_low) {
+        s->tx_full = false;
+
+        if (s->pause_rx) {
+            PauseRx(s->pause_rx, false);
+        }
+
+        LatchTx(s);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+void MT_SetWriteWatermarks(MT_BufferedIO* io, int low, int high)
+{
+    MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+
+    assert(high == 0 || (low >= 0 && low < high));
+
+    s->tx_low = low;
+    s->tx_high = high;
+
+    if (high == 0 && s->tx_full) {
+        /* Turning the watermarks off doesn't call on_drain */
+        s->tx_full = false;
+        s->tx_notified = false;
+
+        if (s->pause_rx) {
+            PauseRx(s->pause_rx, false);
+        }
+    }
+}
+
+bool MT_IsWriteFull(MT_BufferedIO* io)
+{
+    MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+    return s->tx_full;
+}
+
+void MT_SetFlowControl(MT_BufferedIO* io, MT_BufferedIO* rx)
+{
+    MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+    MTI_BufferedIO* r = (MTI_BufferedIO*) rx;
+
+    if (s->pause_rx) {
+        PauseRx(s->pause_rx, false);
+        s->pause_rx->paused_by = NULL;
+        s->pause_rx = NULL;
+    }
+
+    if (r) {
+        if (r->paused_by) {
+            MT_SetFlowControl(&r->paused_by->h, NULL);
+        }
+
+        r->paused_by = s;
+        s->pause_rx = r;
+        PauseRx(r, s->tx_full);
+    }
+}
+
+static void PushSegment(MTI_BufferedIO* s, MTI_TxSegment* g)
+{
+    g->next = NULL;
+
+    if (s->tx_last) {
+        s->tx_last->next = g;
+    } else {
+        s->tx_first = g;
+    }
+
+    s->tx_last = g;
+}
+
+static void FreeSegment(MTI_BufferedIO* s, MTI_TxSegment* g)
+{
+    if (g->type == MTI_TX_COPY && !s->tx_spare) {
+        dv_clear(&g->buf);
+        g->sent = 0;
+        s->tx_spare = g;
+        return;
+    }
+
+    if (g->type == MTI_TX_REF && g->release.func) {
+        CALL_DELEGATE_0(g->release);
+    }
+
+#ifndef _WIN32
+    if (g->type == MTI_TX_FILE) {
+        MT_FreeEvent(g->pipe_reg);
+        close(g->fd);
+        s->tx_files--;
+    }
+#endif
+
+    dv_free(g->buf);
+    free(g);
+}
+
+/* Returns the copy segment at the end of the queue, adding one if needed */
+static MTI_TxSegment* CopySegment(MTI_BufferedIO* s)
+{
+    MTI_TxSegment* g = s->tx_last;
+
+    if (g && g->type == MTI_TX_COPY) {
+        return g;
+    }
+
+    if (s->tx_spare) {
+        g = s->tx_spare;
+        s->tx_spare = NULL;
+    } else {
+        g = NEW(MTI_TxSegment);
+        g->type = MTI_TX_COPY;
+    }
+
+    PushSegment(s, g);
+    return g;
+}
+
+/* Drops bytes from the front of the queue once they have been sent. This also
+ * removes any empty segments and file segments that have hit EOF.
+ */
+static void ConsumeTx(MTI_BufferedIO* s, int bytes)
+{
+    while (s->tx_first) {
+        MTI_TxSegment* g = s->tx_first;
+        int left = SegmentData(g).size;
+
+        if (bytes < left) {
+            g->sent += bytes;
+            s->tx_size -= (g->type != MTI_TX_FILE) ? bytes : 0;
+            break;
+        }
+
+        bytes -= left;
+
+#ifndef _WIN32
+        if (g->type == MTI_TX_FILE) {
+            dv_clear(&g->buf);
+            g->sent = 0;
+
+            if (g->file_left != 0) {
+                break;
+            }
+        } else
+#endif
+        {
+            s->tx_size -= left;
+        }
+
+        s->tx_first = g->next;
+
+        if (!s->tx_first) {
+            s->tx_last = NULL;
+        }
+
+        FreeSegment(s, g);
+    }
+
+    CheckDrained(s);
+}
+
+/* Drops all of the queued data, eg on free */
+static void ClearTx(MTI_BufferedIO* s)
+{
+    while (s->tx_first) {
+        MTI_TxSegment* g = s->tx_first;
+        s->tx_first = g->next;
+        FreeSegment(s, g);
+    }
+
+    s->tx_last = NULL;
+    s->tx_size = 0;
+    s->tx_files = 0;
+
+    if (s->tx_spare) {
+        dv_free(s->tx_spare->buf);
+        free(s->tx_spare);
+        s->tx_spare = NULL;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef _WIN32
 bool MT_SendFile(MT_BufferedIO* io, d_Slice(char) filename)
 {
     MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+    MTI_TxSegment* g = CopySegment(s);
+    int before = g->buf.size;
 
     MT_LOG("IO TX %.*s file %.*s\n", DV_PRI(s->log), DV_PRI(filename));
 
-    if (dv_append_file(&s->tx_buf, filename)) {
+    if (dv_append_file(&g->buf, filename) >= 0) {
+        s->tx_size += g->buf.size - before;
         MT_EnableEvent(s->idle_reg, MT_EVENT_IDLE);
+        CheckFull(s);
         return true;
 
     } else {
+        dv_erase_end(&g->buf, g->buf.size - before);
         return false;
     }
 }
 
-/* ------------------------------------------------------------------------- */
-
-int MT_SendData(MT_BufferedIO* io, d_Slice(char) data)
+#else
+bool MT_SendFile(MT_BufferedIO* io, d_Slice(char) filename)
 {
     MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+    d_Vector(char) path = DV_INIT;
+    MTI_TxSegment* g;
+    struct stat st;
+    int fd;
+
+    MT_LOG("IO TX %.*s file %.*s\n", DV_PRI(s->log), DV_PRI(filename));
+
+    /* Copy the filename to ensure its null terminated. Pipes are opened non
+     * blocking so that we don't wait for the writer here or on reads.
+     */
+    dv_set(&path, filename);
+    fd = open(path.data, O_RDONLY | O_NONBLOCK);
+    dv_free(path);
 
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) || !(S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode))) {
+        close(fd);
+        return false;
+    }
+
+    g = NEW(MTI_TxSegment);
+    g->type = MTI_TX_FILE;
+    g->fd = fd;
+    g->file_left = S_ISREG(st.st_mode) ? (int64_t) st.st_size : -1;
+    PushSegment(s, g);
+
+    s->tx_files++;
+    MT_EnableEvent(s->idle_reg, MT_EVENT_IDLE);
+    return true;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+static void LogTx(MTI_BufferedIO* s, d_Slice(char) data)
+{
     if (MT_LOG_ENABLED) {
         d_Vector(char) dbg = DV_INIT;
         dv_append_hex_dump(&dbg, data, MT_LOG_COLOR);
         MT_LOG("IO TX %.*s\n%.*s\n", DV_PRI(s->log), DV_PRI(dbg));
         dv_free(dbg);
     }
+}
+
+int MT_SendData(MT_BufferedIO* io, d_Slice(char) data)
+{
+    MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+
+    LogTx(s, data);
+
+    if (data.size > 0) {
+        MTI_TxSegment* g = CopySegment(s);
+        dv_append(&g->buf, data);
+        s->tx_size += data.size;
+        MT_EnableEvent(s->idle_reg, MT_EVENT_IDLE);
+        CheckFull(s);
+    }
 
-    dv_append(&s->tx_buf, data);
+    return data.size;
+}
+
+int MT_SendDataRef(MT_BufferedIO* io, d_Slice(char) data, VoidDelegate release)
+{
+    MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+    MTI_TxSegment* g;
+
+    LogTx(s, data);
+
+    if (data.size == 0) {
+        if (release.func) {
+            CALL_DELEGATE_0(release);
+        }
+        return 0;
+    }
+
+    g = NEW(MTI_TxSegment);
+    g->type = MTI_TX_REF;
+    g->ref = data;
+    g->release = release;
+    PushSegment(s, g);
+
+    s->tx_size += data.size;
     MT_EnableEvent(s->idle_reg, MT_EVENT_IDLE);
+    CheckFull(s);
     return data.size;
 }
 
+char* MT_GetSendBuffer(MT_BufferedIO* io, int size)
+{
+    MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+    MTI_TxSegment* g = CopySegment(s);
+    char* ret = dv_append_buffer(&g->buf, size);
+    s->tx_size += size;
+    MT_EnableEvent(s->idle_reg, MT_EVENT_IDLE);
+    CheckFull(s);
+    return ret;
+}
+
 /* ------------------------------------------------------------------------- */
 
 void MT_FreeBufferedIO(MT_BufferedIO* io)
 {
     MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+
+    /* Don't call back into the user whilst the last data is flushed */
+    MT_SetWriteWatermarks(io, 0, 0);
+    MT_SetFlowControl(io, NULL);
+
+    if (s->paused_by) {
+        MT_SetFlowControl(&s->paused_by->h, NULL);
+    }
+
     CALL_DELEGATE_0(s->free);
 }
 
@@ -149,16 +650,18 @@ MT_BufferedIO* MT_NewBufferedSocket(MT_Socket sock, int flags)
 
     s->close_socket_on_free = (flags & MT_CLOSE_SOCKET_ON_FREE) != 0;
     s->is_server = (flags & MT_SERVER_BIO) != 0;
+    s->edge_triggered = (flags & MT_EDGE_TRIGGERED) != 0;
+    s->rx_budget = MTI_RX_BUDGET;
     s->sock = sock;
 
     s->sock_reg = MT_NewClientSocketEvent(
             sock,
             BindVoid(&Socket_ReadyRead, s),
-            BindVoid(&Socket_OnIdle, s),
+            BindVoid(&Socket_OnWrite, s),
             BindVoid(&MT_CloseBufferedIO, &s->h));
 
     s->idle_reg = MT_NewIdleEvent(
-            BindVoid(&Socket_OnIdle, s));
+            BindVoid(&Socket_OnWrite, s));
 
     if (MT_LOG_ENABLED) {
         MT_PeerUrl(&s->log, sock, MT_LOOKUP_HOST);
@@ -176,6 +679,10 @@ MT_BufferedIO* MT_NewBufferedSocket(MT_Socket sock, int flags)
     MT_DisableEvent(s->idle_reg, MT_EVENT_IDLE);
     MT_DisableEvent(s->sock_reg, MT_EVENT_WRITE);
 
+    if (s->edge_triggered) {
+        MT_EnableEvent(s->sock_reg, MT_EVENT_EDGE);
+    }
+
     return &s->h;
 }
 
@@ -194,7 +701,7 @@ static void Socket_Free(MTI_BufferedIO* s)
         closesocket(s->sock);
     }
 
-    dv_free(s->tx_buf);
+    ClearTx(s);
     dv_free(s->rx_buf);
     dv_free(s->log);
     dv_free(s->keepalive_data);
@@ -204,26 +711,165 @@ static void Socket_Free(MTI_BufferedIO* s)
 
 /* ------------------------------------------------------------------------- */
 
-static void Socket_ReadyRead(MTI_BufferedIO* s)
+/* Returns space for at least size more bytes at rx_end. Consumed data at the
+ * front is only reclaimed by moving the unused data down if that frees at
+ * least as much as it copies or if the buffer has to grow anyway. This keeps
+ * the copying linear in the amount of data received.
+ */
+static char* ReserveRx(MTI_BufferedIO* s, int size)
+{
+    int used = s->rx_end - s->rx_begin;
+
+    if (s->rx_buf.size - s->rx_end >= size) {
+        return s->rx_buf.data + s->rx_end;
+    }
+
+    if (s->rx_begin > 0 && (s->rx_begin >= used || s->rx_buf.size - used < size)) {
+        memmove(s->rx_buf.data, s->rx_buf.data + s->rx_begin, used);
+        s->rx_begin = 0;
+        s->rx_end = used;
+    }
+
+    if (s->rx_buf.size - s->rx_end < size) {
+        int newsz = s->rx_buf.size * 2;
+
+        if (newsz < s->rx_end + size) {
+            newsz = s->rx_end + size;
+        }
+
+        dv_resize(&s->rx_buf, newsz);
+    }
+
+    return s->rx_buf.data + s->rx_end;
+}
+
+static d_Slice(char) RxData(MTI_BufferedIO* s)
+{
+    return dv_char2(s->rx_buf.data + s->rx_begin, s->rx_end - s->rx_begin);
+}
+
+/* Hands the received data to on_rx. Returns false if the IO has been
+ * closed.
+ */
+static bool DeliverRx(MTI_BufferedIO* s, int got)
 {
-    char* dest;
-    int got = BUFSZ;
     int used;
 
-    while (got == BUFSZ) {
-        dest = dv_append_buffer(&s->rx_buf, BUFSZ);
-        got = recv(s->sock, dest, BUFSZ, 0);
-        dv_erase_end(&s->rx_buf, (got >= 0 ? BUFSZ - got : BUFSZ));
+    if (MT_LOG_ENABLED) {
+        d_Vector(char) dbg = DV_INIT;
+        dv_append_hex_dump(&dbg, dv_char2(s->rx_buf.data + s->rx_end - got, got), MT_LOG_COLOR);
+        MT_LOG("IO RX %.*s\n%.*s\n", DV_PRI(s->log), DV_PRI(dbg));
+        dv_free(dbg);
+    }
+
+    used = CALL_DELEGATE_1(s->h.on_rx, RxData(s));
+
+    if (used < 0) {
+        MT_CloseBufferedIO(&s->h);
+        return false;
+    }
+
+    s->rx_begin += used;
+
+    if (s->rx_begin == s->rx_end) {
+        s->rx_begin = s->rx_end = 0;
+
+        if (s->rx_buf.size > MTI_RX_KEEP) {
+            dv_resize(&s->rx_buf, BUFSZ);
+        }
+    }
+
+    return true;
+}
+
+/* Reads into the space at the end of rx_buf and then the overflow buffer.
+ * Returns the total read, which may not all have been moved into rx_buf.
+ */
+static int ReadSocket(MTI_BufferedIO* s, char* dest, int size, char* overflow)
+{
+    int got;
+
+#ifdef _WIN32
+    WSABUF bufs[2];
+    DWORD recvd, flags = 0;
+
+    bufs[0].buf = dest;
+    bufs[0].len = size;
+    bufs[1].buf = overflow;
+    bufs[1].len = MTI_RX_OVERFLOW;
+
+    got = WSARecv(s->sock, bufs, 2, &recvd, &flags, NULL, NULL) ? -1 : (int) recvd;
+
+#else
+    struct iovec bufs[2];
+
+    bufs[0].iov_base = dest;
+    bufs[0].iov_len = size;
+    bufs[1].iov_base = overflow;
+    bufs[1].iov_len = MTI_RX_OVERFLOW;
+
+    got = (int) readv(s->sock, bufs, 2);
+#endif
+
+    return got;
+}
+
+void MT_SetReadBudget(MT_BufferedIO* io, int bytes)
+{
+    MTI_BufferedIO* s = (MTI_BufferedIO*) io;
+    s->rx_budget = bytes;
+}
+
+static bool OverBudget(MTI_BufferedIO* s, int total)
+{
+    return s->rx_budget > 0 && total >= s->rx_budget;
+}
+
+static void Socket_ReadyRead(MTI_BufferedIO* s)
+{
+    char overflow[MTI_RX_OVERFLOW];
+    int want = 0;
+    int got = 0;
+    int total = 0;
+
+    s->rx_ready = true;
+
+    /* Level triggered sockets stop at the first short read and leave the rest
+     * to the next notification. Edge triggered sockets won't get another
+     * notification so have to keep going until recv would block. Both stop
+     * once the read budget is used up so that a flooding peer can't hold up
+     * the rest of the loop.
+     */
+    while ((got == want || (s->rx_ready && s->edge_triggered)) && !OverBudget(s, total)) {
+        char* dest = ReserveRx(s, BUFSZ);
+        int room = s->rx_buf.size - s->rx_end;
+
+        want = room + MTI_RX_OVERFLOW;
+        got = ReadSocket(s, dest, room, overflow);
+
+        if (got > room) {
+            s->rx_end += room;
+            memcpy(ReserveRx(s, got - room), overflow, got - room);
+            s->rx_end += got - room;
+        } else if (got > 0) {
+            s->rx_end += got;
+        }
+
+        total += (got > 0) ? got : 0;
 
 #ifndef _WIN32
         /* Force us to go around again */
         if (got < 0 && errno == EINTR) {
-            got = BUFSZ;
+            got = want;
         }
 #endif
+
+        if (got <= 0) {
+            s->rx_ready = false;
+        }
     }
 
-    if (got == 0) {
+    if (got == 0 && total == 0) {
         MT_CloseBufferedIO(&s->h);
         return;
     } 
@@ -238,66 +884,285 @@ static void Socket_ReadyRead(MTI_BufferedIO* s)
         return;
     }
 
+    if (total == 0) {
+        return;
+    }
+
     MT_ResetEvent(s->keepalive_reg);
 
-    if (MT_LOG_ENABLED) {
-        d_Vector(char) dbg = DV_INIT;
-        dv_append_hex_dump(&dbg, dv_right(s->rx_buf, -got), MT_LOG_COLOR);
-        MT_LOG("IO RX %.*s\n%.*s\n", DV_PRI(s->log), DV_PRI(dbg));
-        dv_free(dbg);
+    if (!DeliverRx(s, total)) {
+        return;
     }
 
-    used = CALL_DELEGATE_1(s->h.on_rx, s->rx_buf);
-
-    if (used < 0) {
+    if (got == 0) {
+        /* The remote end closed after sending the data we just handed on */
         MT_CloseBufferedIO(&s->h);
-    } else {
-        dv_erase(&s->rx_buf, 0, used);
+
+    } else if (s->rx_ready && s->edge_triggered && !s->rx_paused) {
+        /* We stopped on the budget before recv would block. Rearming the
+         * edge triggered registration queues another notification if the
+         * socket is still readable, so we carry on in the next batch.
+         */
+        MT_RearmEvent(s->sock_reg);
     }
 }
 
 /* ------------------------------------------------------------------------- */
 
+#ifndef _WIN32
+enum MTI_FileResult {
+    MTI_FILE_MORE,
+    MTI_FILE_WAIT_SOCKET,
+    MTI_FILE_WAIT_PIPE
+};
+
+/* Reads the next chunk of a file segment into its buffer */
+static int ReadFileChunk(MTI_TxSegment* g)
+{
+    int toread = MTI_TX_FILE_CHUNK;
+    char* buf;
+    int got;
+
+    if (g->file_left >= 0 && g->file_left < toread) {
+        toread = (int) g->file_left;
+    }
+
+    buf = dv_append_buffer(&g->buf, toread);
+
+    do {
+        if (g->file_left < 0) {
+            got = (int) read(g->fd, buf, toread);
+        } else {
+            got = (int) pread(g->fd, buf, toread, g->file_offset);
+        }
+    } while (got < 0 && errno == EINTR);
+
+    dv_erase_end(&g->buf, toread - (got > 0 ? got : 0));
+    g->file_offset += (got > 0) ? got : 0;
+    return got;
+}
+
+#ifdef MTI_USE_SENDFILE
+/* Sends from the file straight to the socket without copying through
+ * userspace.
+ */
+static int SendFileDirect(MTI_BufferedIO* s, MTI_TxSegment* g)
+{
+    size_t tosend = INT_MAX;
+    ssize_t ret;
+
+    if (g->file_left >= 0 && g->file_left < INT_MAX) {
+        tosend = (size_t) g->file_left;
+    }
+
+    do {
+        if (g->file_left < 0) {
+            ret = splice(g->fd, NULL, s->sock, NULL, tosend, SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+        } else {
+            ret = sendfile(s->sock, g->fd, &g->file_offset, tosend);
+        }
+    } while (ret < 0 && errno == EINTR);
+
+    return (int) ret;
+}
+#endif
+
+/* The registration is removed rather than disabled as a pipe whose writer
+ * has gone keeps reporting a hangup.
+ */
+static void PipeReady(MTI_BufferedIO* s)
+{
+    MTI_TxSegment* g = s->tx_first;
+    MT_FreeEvent(g->pipe_reg);
+    g->pipe_reg = NULL;
+    MT_EnableEvent(s->idle_reg, MT_EVENT_IDLE);
+}
+
+/* Returns true and waits for the pipe if it is what we blocked on */
+static bool WaitForPipe(MTI_BufferedIO* s, MTI_TxSegment* g)
+{
+    struct pollfd pfd;
+
+    if (g->file_left >= 0) {
+        return false;
+    }
+
+    pfd.fd = g->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 0) > 0) {
+        return false;
+    }
+
+    if (!g->pipe_reg) {
+        VoidDelegate null = NULL_DELEGATE;
+        g->pipe_reg = MT_NewClientSocketEvent(
+                g->fd,
+                BindVoid(&PipeReady, s),
+                null,
+                BindVoid(&PipeReady, s));
+    }
+
+    return true;
+}
+
+/* Moves data on from the file segment at the front of the queue. Direct
+ * sends go straight to the socket. Otherwise the next chunk is read into the
+ * segment's buffer to be written out by the caller.
+ */
+static enum MTI_FileResult FlushFile(MTI_BufferedIO* s, MTI_TxSegment* g, bool direct)
+{
+    int ret;
+
+#ifdef MTI_USE_SENDFILE
+    if (direct) {
+        ret = SendFileDirect(s, g);
+
+        /* Fall back to reading if the kernel can't do this pair of files */
+        if (ret < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            ret = ReadFileChunk(g);
+        }
+    } else
+#endif
+    {
+        (void) direct;
+        ret = ReadFileChunk(g);
+    }
+
+    if (ret < 0 && errno == EAGAIN) {
+        return WaitForPipe(s, g) ? MTI_FILE_WAIT_PIPE : MTI_FILE_WAIT_SOCKET;
+    }
+
+    if (ret < 0) {
+        MT_LOG("IO TX %.*s file error %d\n", DV_PRI(s->log), errno);
+        dv_clear(&g->buf);
+    }
+
+    if (ret > 0 && g->file_left > 0) {
+        g->file_left -= ret;
+    } else if (ret <= 0) {
+        /* EOF, the file has been truncated or an error */
+        g->file_left = 0;
+    }
+
+    /* Removes the segment if we are done with it */
+    if (g->buf.size == 0) {
+        ConsumeTx(s, 0);
+    }
+
+    return MTI_FILE_MORE;
+}
+#endif
+
+/* Writes as many segments from the front of the queue as fit in one
+ * writev. Returns the number of bytes written or -1 and sets *tried to the
+ * number of bytes we tried to write. This stops at file segments as only
+ * their current chunk is in memory.
+ */
+static int WriteSegments(MTI_BufferedIO* s, int* tried)
+{
+    MTI_TxSegment* g;
+    int num = 0;
+    int ret;
+
+#ifdef _WIN32
+    WSABUF bufs[MTI_TX_IOVECS];
+    DWORD sent;
+#else
+    struct iovec bufs[MTI_TX_IOVECS];
+#endif
+
+    *tried = 0;
+
+    for (g = s->tx_first; g != NULL && num < MTI_TX_IOVECS; g = g->next) {
+        d_Slice(char) data = SegmentData(g);
+#ifdef _WIN32
+        bufs[num].buf = (char*) data.data;
+        bufs[num].len = data.size;
+#else
+        bufs[num].iov_base = (void*) data.data;
+        bufs[num].iov_len = data.size;
+#endif
+        *tried += data.size;
+        num++;
+
+        if (g->type == MTI_TX_FILE) {
+            break;
+        }
+    }
+
+#ifdef _WIN32
+    ret = WSASend(s->sock, bufs, num, &sent, 0, NULL, NULL) ? -1 : (int) sent;
+#else
+    do {
+        ret = (int) writev(s->sock, bufs, num);
+    } while (ret < 0 && errno == EINTR);
+#endif
+
+    return ret;
+}
+
 static void Socket_OnIdle(MTI_BufferedIO* s)
 {
-    int written = 0;
+    bool wait_pipe = false;
 
     MT_DisableEvent(s->idle_reg, MT_EVENT_IDLE);
 
-    if (s->tx_buf.size == 0) {
+    if (!TxPending(s)) {
         return;
     }
 
     MT_ResetEvent(s->keepalive_reg);
 
-#ifndef _WIN32
-    do {
-#endif
-        int ret = (int) send(s->sock, s->tx_buf.data + written, s->tx_buf.size - written, 0);
-        written += (ret >= 0) ? ret : 0;
+    /* Keep going whilst the socket takes everything we give it and there
+     * are more segments than fit in one writev.
+     */
+    while (TxPending(s)) {
+        int tried;
+        int written;
 
 #ifndef _WIN32
-    } while (written < s->tx_buf.size && errno == EINTR);
-#endif
+        if (s->tx_first->type == MTI_TX_FILE && s->tx_first->buf.size == 0) {
+            enum MTI_FileResult res = FlushFile(s, s->tx_first, true);
+            wait_pipe = (res == MTI_FILE_WAIT_PIPE);
 
-#if 0
-    if (MT_LOG_ENABLED) {
-        d_Vector(char) dbg = DV_INIT;
-        dv_append_hex_dump(&dbg, dv_left(s->tx_buf, written), MT_LOG_COLOR);
-        MT_LOG("IO Flush %.*s\n%.*s\n", DV_PRI(s->log), DV_PRI(dbg));
-        dv_free(dbg);
-    }
+            if (res != MTI_FILE_MORE) {
+                break;
+            }
+
+            continue;
+        }
 #endif
 
-    dv_erase(&s->tx_buf, 0, written);
+        written = WriteSegments(s, &tried);
 
-    if (s->tx_buf.size > 0) {
+        if (written < 0) {
+            break;
+        }
+
+        ConsumeTx(s, written);
+
+        if (written < tried) {
+            break;
+        }
+    }
+
+    if (TxPending(s) && !wait_pipe) {
         MT_EnableEvent(s->sock_reg, MT_EVENT_WRITE);
     } else {
         MT_DisableEvent(s->sock_reg, MT_EVENT_WRITE);
     }
 }
 
+/* Idle and write event callback */
+static void Socket_OnWrite(MTI_BufferedIO* s)
+{
+    if (!NotifyTx(s)) {
+        Socket_OnIdle(s);
+    }
+}
+
 /* ------------------------------------------------------------------------- */
 
 void MT_SetupKeepalive(MT_BufferedIO* io, MT_Time timeout, d_Slice(char) data)
@@ -350,7 +1215,8 @@ bool MT_EnableTLS(MT_BufferedIO* io, SSL_CTX* ctx)
 
     /* Try and flush out any remaining data */
     Socket_OnIdle(s);
-    dv_clear(&s->tx_buf);
+    ClearTx(s);
+    CheckDrained(s);
 
     if (ctx) {
         s->ssl = SSL_new(ctx);
@@ -374,6 +1240,11 @@ bool MT_EnableTLS(MT_BufferedIO* io, SSL_CTX* ctx)
     SSL_set_fd(s->ssl, s->sock);
     SSL_set_verify(s->ssl, SSL_VERIFY_NONE, NULL);
 
+    /* Retried writes may be for a copy segment that has since been appended
+     * to and reallocated.
+     */
+    SSL_set_mode(s->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
     if (s->is_server) {
         SSL_set_accept_state(s->ssl);
     } else {
@@ -389,15 +1260,21 @@ bool MT_EnableTLS(MT_BufferedIO* io, SSL_CTX* ctx)
     s->sock_reg = MT_NewClientSocketEvent(
             s->sock,
             BindVoid(&SSL_ReadyRead, s),
-            BindVoid(&SSL_OnIdle, s),
+            BindVoid(&SSL_OnWrite, s),
             BindVoid(&MT_CloseBufferedIO, &s->h));
 
     s->idle_reg = MT_NewIdleEvent(
-            BindVoid(&SSL_OnIdle, s));
+            BindVoid(&SSL_OnWrite, s));
 
     MT_DisableEvent(s->idle_reg, MT_EVENT_IDLE);
     MT_DisableEvent(s->sock_reg, MT_EVENT_WRITE);
 
+    if (s->rx_paused) {
+        MT_DisableEvent(s->sock_reg, MT_EVENT_READ);
+    }
+
+    LatchTx(s);
+
     ret = SSL_do_handshake(s->ssl);
     if (ret <= 0) {
         s->in_init = true;
@@ -418,7 +1295,7 @@ void MT_DisableTLS(MT_BufferedIO* io)
     if (s->ssl) {
         /* Try and flush out any remaining data */
         SSL_OnIdle(s);
-        dv_clear(&s->tx_buf);
+        ClearTx(s);
 
         SSL_shutdown(s->ssl);
         SSL_free(s->ssl);
@@ -432,14 +1309,25 @@ void MT_DisableTLS(MT_BufferedIO* io)
         s->sock_reg = MT_NewClientSocketEvent(
                 s->sock,
                 BindVoid(&Socket_ReadyRead, s),
-                BindVoid(&Socket_OnIdle, s),
+                BindVoid(&Socket_OnWrite, s),
                 BindVoid(&MT_CloseBufferedIO, &s->h));
 
         s->idle_reg = MT_NewIdleEvent(
-                BindVoid(&Socket_OnIdle, s));
+                BindVoid(&Socket_OnWrite, s));
 
         MT_DisableEvent(s->idle_reg, MT_EVENT_IDLE);
         MT_DisableEvent(s->sock_reg, MT_EVENT_WRITE);
+
+        if (s->rx_paused) {
+            MT_DisableEvent(s->sock_reg, MT_EVENT_READ);
+        }
+
+        if (s->edge_triggered) {
+            MT_EnableEvent(s->sock_reg, MT_EVENT_EDGE);
+        }
+
+        CheckDrained(s);
+        LatchTx(s);
     }
 }
 
@@ -515,78 +1403,90 @@ static void SSL_OnError(MTI_BufferedIO* s, int ret)
 
 static void SSL_ReadyRead(MTI_BufferedIO* s)
 {
-    int got, used;
+    int got;
 
-    size_t to_read = SSL_pending(s->ssl) + BUFSZ;
-    char* dest = dv_append_buffer(&s->rx_buf, to_read);
+    int to_read = SSL_pending(s->ssl) + BUFSZ;
+    char* dest = ReserveRx(s, to_read);
 
     got = SSL_read(s->ssl, dest, to_read);
 
     MT_ResetEvent(s->keepalive_reg);
-    dv_erase_end(&s->rx_buf, (got >= 0) ? BUFSZ - got : BUFSZ);
 
     if (got <= 0) {
         SSL_OnError(s, got);
         return;
     }
 
+    s->rx_end += got;
+
     if (s->flush_after_read) {
         s->flush_after_read = false;
         SSL_OnIdle(s);
     }
 
-    if (MT_LOG_ENABLED) {
-        d_Vector(char) dbg = DV_INIT;
-        dv_append_hex_dump(&dbg, dv_right(s->rx_buf, -got), MT_LOG_COLOR);
-        MT_LOG("IO RX %.*s\n%.*s\n", DV_PRI(s->log), DV_PRI(dbg));
-        dv_free(dbg);
-    }
-
-    used = CALL_DELEGATE_1(s->h.on_rx, s->rx_buf);
-
-    if (used < 0) {
-        MT_CloseBufferedIO(&s->h);
-    } else {
-        dv_erase(&s->rx_buf, 0, used);
-    }
+    DeliverRx(s, got);
 }
 
 /* ------------------------------------------------------------------------- */
 
 static void SSL_OnIdle(MTI_BufferedIO* s)
 {
-    int sent;
-
     s->flush_after_read = false;
     MT_DisableEvent(s->idle_reg, MT_EVENT_IDLE);
 
-    if (s->tx_buf.size == 0) {
+    if (!TxPending(s)) {
         return;
     }
 
     MT_ResetEvent(s->keepalive_reg);
-    sent = SSL_write(s->ssl, s->tx_buf.data, s->tx_buf.size);
 
-    if (sent <= 0) {
-        SSL_OnError(s, sent);
-        return;
-    }
+    /* TLS records are written a segment at a time. Files are read through
+     * the segment's buffer a chunk at a time.
+     */
+    while (TxPending(s)) {
+        MTI_TxSegment* g = s->tx_first;
+        d_Slice(char) data = SegmentData(g);
+        int sent;
 
-#if 0
-    if (MT_LOG_ENABLED) {
-        d_Vector(char) dbg = DV_INIT;
-        dv_append_hex_dump(&dbg, dv_left(s->tx_buf, sent), MT_LOG_COLOR);
-        MT_LOG("IO Flush %.*s\n%.*s\n", DV_PRI(s->log), DV_PRI(dbg));
-        dv_free(dbg);
-    }
+#ifndef _WIN32
+        if (g->type == MTI_TX_FILE && data.size == 0) {
+            enum MTI_FileResult res = FlushFile(s, g, false);
+
+            if (res == MTI_FILE_WAIT_PIPE) {
+                MT_DisableEvent(s->sock_reg, MT_EVENT_WRITE);
+                return;
+            } else if (res == MTI_FILE_WAIT_SOCKET) {
+                MT_EnableEvent(s->sock_reg, MT_EVENT_WRITE);
+                return;
+            }
+
+            continue;
+        }
 #endif
 
-    dv_erase(&s->tx_buf, 0, sent);
+        if (data.size == 0) {
+            ConsumeTx(s, 0);
+            continue;
+        }
 
-    if (s->tx_buf.size) {
-        MT_EnableEvent(s->sock_reg, MT_EVENT_WRITE);
-    } else {
-        MT_DisableEvent(s->sock_reg, MT_EVENT_WRITE);
+        sent = SSL_write(s->ssl, data.data, data.size);
+
+        if (sent <= 0) {
+            SSL_OnError(s, sent);
+            return;
+        }
+
+        ConsumeTx(s, sent);
+    }
+
+    MT_DisableEvent(s->sock_reg, MT_EVENT_WRITE);
+}
+
+/* Idle and write event callback */
+static void SSL_OnWrite(MTI_BufferedIO* s)
+{
+    if (!NotifyTx(s)) {
+        SSL_OnIdle(s);
     }
 }
 
@@ -32,8 +32,18 @@
 #include <mt/time.h>
 #include <limits.h>
 #include <assert.h>
+#include <errno.h>
 
-static void StepEventQueue(MTI_EventQueue* s);
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#define SOCKET_EVENT(r)  container_of(r, MTI_SocketEvent, event)
+#define TICK_EVENT(r)    container_of(r, MTI_TickEvent, event)
+#define IDLE_EVENT(r)    container_of(r, MTI_IdleEvent, event)
+#define HANDLE_EVENT(r)  container_of(r, MTI_HandleEvent, event)
+
+static void StepEventQueue(MTI_EventQueue* s, int max_batch);
 
 /* ------------------------------------------------------------------------- */
 
@@ -45,13 +55,78 @@ static MTI_EventQueue* CreateCurrentEventQueue(void)
 
 /* ------------------------------------------------------------------------- */
 
+static void InitSlab(MTI_EventSlab* s, size_t object_size)
+{
+    assert(object_size >= sizeof(void*));
+    s->object_size = object_size;
+    s->used = MTI_SLAB_OBJECTS;
+    s->free_list = NULL;
+}
+
+static void DestroySlab(MTI_EventSlab* s)
+{
+    int i;
+
+    for (i = 0; i < s->chunks.size; i++) {
+        free(s->chunks.data[i]);
+    }
+
+    dv_free(s->chunks);
+}
+
+/* Returns a zeroed object */
+static void* SlabAlloc(MTI_EventSlab* s)
+{
+    void* p;
+
+    if (s->free_list) {
+        p = s->free_list;
+        s->free_list = *(void**) p;
+
+    } else {
+        if (s->used == MTI_SLAB_OBJECTS) {
+            char* chunk = (char*) malloc(s->object_size * MTI_SLAB_OBJECTS);
+            dv_append2(&s->chunks, &chunk, 1);
+            s->used = 0;
+        }
+
+        p = dv_last(s->chunks) + s->object_size * s->used++;
+    }
+
+    memset(p, 0, s->object_size);
+    return p;
+}
+
+static void SlabFree(MTI_EventSlab* s, void* p)
+{
+    *(void**) p = s->free_list;
+    s->free_list = p;
+}
+
+/* ------------------------------------------------------------------------- */
+
 void MTI_InitEventQueue(MTI_EventQueue* s, MT_MessageQueue* q)
 {
     memset(s, 0, sizeof(MTI_EventQueue));
 
     s->exit = false;
+    s->message_queue = q;
     s->next_idle = 0;
     s->next_event = -1;
+    s->now = MT_TIME_INVALID;
+
+    InitSlab(&s->socket_slab, sizeof(MTI_SocketEvent));
+    InitSlab(&s->tick_slab, sizeof(MTI_TickEvent));
+    InitSlab(&s->idle_slab, sizeof(MTI_IdleEvent));
+#ifdef _WIN32
+    InitSlab(&s->handle_slab, sizeof(MTI_HandleEvent));
+#endif
+
+#ifdef MTI_USE_EPOLL
+    /* Falls back to poll if we can't get an epoll handle */
+    s->epoll = epoll_create1(EPOLL_CLOEXEC);
+    s->next_ready = 0;
+#endif
 
     MTI_InitWakeupEvent(&s->wakeup, s, BindVoid(&MT_ProcessMessageQueue, q));
     MT_SetMessageQueueWakeup(q, BindVoid(&MTI_TriggerWakeupEvent, &s->wakeup));
@@ -61,6 +136,8 @@ void MTI_InitEventQueue(MTI_EventQueue* s, MT_MessageQueue* q)
 
 void MTI_DestroyEventQueue(MTI_EventQueue* s)
 {
+    int i;
+
     MTI_DestroyWakeupEvent(&s->wakeup);
 
     assert(s->events.size == 0);
@@ -68,12 +145,33 @@ void MTI_DestroyEventQueue(MTI_EventQueue* s)
 
     assert(s->socket_regs.size == 0);
     assert(s->idle_regs.size == 0);
-    assert(s->tick_regs.size == 0);
+
+    /* Only freed timeouts that haven't been removed from the heap yet should
+     * be left. Their memory goes with the slab.
+     */
+    for (i = 0; i < s->tick_regs.size; i++) {
+        assert(s->tick_regs.data[i]->freed);
+    }
 
     dv_free(s->socket_regs);
     dv_free(s->idle_regs);
     dv_free(s->tick_regs);
 
+    DestroySlab(&s->socket_slab);
+    DestroySlab(&s->tick_slab);
+    DestroySlab(&s->idle_slab);
+#ifdef _WIN32
+    DestroySlab(&s->handle_slab);
+#endif
+
+#ifdef MTI_USE_EPOLL
+    if (s->epoll >= 0) {
+        close(s->epoll);
+    }
+
+    dv_free(s->ready);
+#endif
+
 #ifdef _WIN32
     assert(s->handle_regs.size == 0);
     assert(s->handles.size == 0);
@@ -99,45 +197,324 @@ void MT_ExitEventLoop(void)
 /* ------------------------------------------------------------------------- */
 
 void MT_RunEventLoop(void)
+{ MT_RunEventLoop2(MT_EVENT_LOOP_BATCH); }
+
+void MT_RunEventLoop2(int max_batch)
 {
     MTI_EventQueue* s = CreateCurrentEventQueue();
 
+    assert(max_batch > 0);
+
     while (!s->exit) {
-        StepEventQueue(s);
+        StepEventQueue(s, max_batch);
     }
+
+    /* Reset so that the loop can be run again */
+    s->exit = false;
 }
 
 /* ------------------------------------------------------------------------- */
 
-static int FindFirstGreaterOrEqual(d_Vector(EventRegistration)* vec, MT_Time nextTick)
+void MT_SetEventLoopSpin(int spins)
 {
-    int sz = vec->size;
-    int half;
-    int begin, middle, end;
+    MTI_EventQueue* s = CreateCurrentEventQueue();
 
-    begin = 0;
-    end   = sz;
+    /* With one CPU the producer can't run whilst we spin */
+    if (spins < 0 || MTI_CpuCount() <= 1) {
+        spins = 0;
+    }
 
-    /* This is a modified version of std::upper_bound where the comparison
-     * operator has been changed from '<' to '<='.
-     */
-    while (sz > 0) {
-        half = sz / 2;
-        middle = begin + half;
+    s->spin_max = spins;
+    s->spin_limit = spins;
+}
 
-        if (nextTick <= vec->data[middle]->next_tick) {
-            /* upper bound is in first half */
-            sz = half;
+/* ------------------------------------------------------------------------- */
+
+/* Spins on the message queue before we block. The spin is doubled each time
+ * it catches a message and halved each time it times out.
+ */
+static bool SpinEventQueue(MTI_EventQueue* s)
+{
+    int min = s->spin_max / MTI_SPIN_MIN_DIVISOR + 1;
+
+    if (MTI_SpinMessageQueue(s->message_queue, s->spin_limit)) {
+        s->spin_limit = s->spin_limit * 2 < s->spin_max ? s->spin_limit * 2 : s->spin_max;
+        return true;
+    }
+
+    s->spin_limit = s->spin_limit / 2 > min ? s->spin_limit / 2 : min;
+    return false;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Reads the monotonic clock used for the loop time. The coarse clock avoids
+ * the cost of reading the hardware timer but is only used if it's accurate
+ * enough for the millisecond resolution of the OS wait. Both clocks share the
+ * same base.
+ */
+static MT_Time ReadLoopClock(void)
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+    static int use_coarse = -1;
+    struct timespec ts;
+
+    if (use_coarse < 0) {
+        use_coarse = !clock_getres(CLOCK_MONOTONIC_COARSE, &ts)
+                  && ts.tv_sec == 0
+                  && ts.tv_nsec <= 1000000;
+    }
+
+    if (use_coarse && !clock_gettime(CLOCK_MONOTONIC_COARSE, &ts)) {
+        return MT_TIME_FROM_SECONDS(ts.tv_sec) + MT_TIME_FROM_US(ts.tv_nsec / 1000);
+    }
+#endif
+
+    return MT_MonotonicTime();
+}
+
+/* The loop time is read at most once per batch of callbacks and is then
+ * cached until the next batch.
+ */
+static MT_Time LoopTime(MTI_EventQueue* s)
+{
+    if (!MT_TIME_ISVALID(s->now)) {
+        s->now = ReadLoopClock();
+    }
+
+    return s->now;
+}
+
+MT_Time MT_LoopTime(void)
+{ return LoopTime(CreateCurrentEventQueue()); }
+
+/* ------------------------------------------------------------------------- */
+
+/* The tick registrations are kept in a 4-ary min heap ordered by heap_tick.
+ * Each registration stores its index in the heap in regnum so that it can be
+ * removed without a search.
+ */
+
+#define HEAP_ARITY 4
+#define HEAP_PARENT(i) (((i) - 1) / HEAP_ARITY)
+#define HEAP_CHILD(i) (((i) * HEAP_ARITY) + 1)
+
+static void HeapSet(d_Vector(TickRegistration)* h, int i, MTI_TickEvent* t)
+{
+    h->data[i] = t;
+    t->event.regnum = i;
+}
+
+static void SiftUp(d_Vector(TickRegistration)* h, int i)
+{
+    MTI_TickEvent* t = h->data[i];
+
+    while (i > 0) {
+        int parent = HEAP_PARENT(i);
+
+        if (h->data[parent]->heap_tick <= t->heap_tick) {
+            break;
+        }
+
+        HeapSet(h, i, h->data[parent]);
+        i = parent;
+    }
+
+    HeapSet(h, i, t);
+}
+
+static void SiftDown(d_Vector(TickRegistration)* h, int i)
+{
+    MTI_TickEvent* t = h->data[i];
+
+    for (;;) {
+        int child = HEAP_CHILD(i);
+        int end = child + HEAP_ARITY;
+        int min = i;
+        MT_Time min_tick = t->heap_tick;
+
+        if (end > h->size) {
+            end = h->size;
+        }
+
+        for (; child < end; child++) {
+            if (h->data[child]->heap_tick < min_tick) {
+                min = child;
+                min_tick = h->data[child]->heap_tick;
+            }
+        }
+
+        if (min == i) {
+            break;
+        }
+
+        HeapSet(h, i, h->data[min]);
+        i = min;
+    }
+
+    HeapSet(h, i, t);
+}
+
+static void InsertTick(MTI_EventQueue* s, MTI_TickEvent* t)
+{
+    dv_append2(&s->tick_regs, &t, 1);
+    SiftUp(&s->tick_regs, s->tick_regs.size - 1);
+}
+
+static void RemoveTick(MTI_EventQueue* s, MTI_TickEvent* t)
+{
+    int i = t->event.regnum;
+    MTI_TickEvent* last = dv_last(s->tick_regs);
+
+    assert(s->tick_regs.data[i] == t);
+    dv_erase_end(&s->tick_regs, 1);
+    t->event.regnum = -1;
+
+    if (last != t) {
+        HeapSet(&s->tick_regs, i, last);
+
+        if (i > 0 && s->tick_regs.data[HEAP_PARENT(i)]->heap_tick > last->heap_tick) {
+            SiftUp(&s->tick_regs, i);
+        } else {
+            SiftDown(&s->tick_regs, i);
+        }
+    }
+}
+
+/* Timeouts are expected to be cancelled far more often than they fire (eg
+ * per request timeouts). Disabling or freeing a timeout leaves it in the heap
+ * as a dead entry which is then dropped once it gets to the top of the heap.
+ * Freed timeouts are then returned to the tick slab.
+ */
+
+static void RecycleTimeout(MTI_EventQueue* s, MTI_TickEvent* t)
+{
+    assert(t->event.type == MTI_TIMEOUT && t->event.regnum < 0);
+    SlabFree(&s->tick_slab, t);
+}
+
+/* Drops all of the dead timeouts from the heap in one go. This is called once
+ * the heap is mostly dead entries so that long timeouts that are cancelled
+ * early don't accumulate.
+ */
+static void CompactTicks(MTI_EventQueue* s)
+{
+    d_Vector(TickRegistration)* h = &s->tick_regs;
+    int i, j = 0;
+
+    for (i = 0; i < h->size; i++) {
+        MTI_TickEvent* t = h->data[i];
+
+        if (t->event.enabled) {
+            HeapSet(h, j++, t);
         } else {
-            /* upper bound is in second half */
-            begin = middle + 1;
-            sz = sz - half - 1;
+            t->event.regnum = -1;
+
+            if (t->freed) {
+                RecycleTimeout(s, t);
+            }
         }
     }
 
-    return begin;
+    dv_resize(h, j);
+    s->dead_ticks = 0;
+
+    for (i = h->size > 1 ? HEAP_PARENT(h->size - 1) : -1; i >= 0; i--) {
+        SiftDown(h, i);
+    }
 }
 
+static void KillTimeout(MTI_EventQueue* s, MTI_TickEvent* t)
+{
+    assert(t->event.type == MTI_TIMEOUT && t->event.regnum >= 0);
+    t->event.enabled = false;
+    s->dead_ticks++;
+
+    if (s->dead_ticks > 64 && s->dead_ticks > s->tick_regs.size / 2) {
+        CompactTicks(s);
+    }
+}
+
+/* Fires the first tick registration if it has expired. Registrations that
+ * have been pushed back by MT_ResetEvent are left in place in the heap until
+ * they reach the top, at which point they are moved to their new position.
+ * Returns non-zero if a callback was called.
+ */
+static int HandleTick(MTI_EventQueue* s, MT_Time current_time)
+{
+    while (s->tick_regs.size > 0) {
+        MTI_TickEvent* t = s->tick_regs.data[0];
+
+        if (!t->event.enabled) {
+            /* Dead timeout */
+            RemoveTick(s, t);
+            s->dead_ticks--;
+
+            if (t->freed) {
+                RecycleTimeout(s, t);
+            }
+
+            continue;
+        }
+
+        if (current_time < t->heap_tick) {
+            return 0;
+        }
+
+        if (current_time < t->next_tick) {
+            /* This was reset after being added to the heap */
+            t->heap_tick = t->next_tick;
+            SiftDown(&s->tick_regs, 0);
+            continue;
+        }
+
+        if (t->event.type == MTI_TIMEOUT) {
+            RemoveTick(s, t);
+            t->event.enabled = false;
+        } else {
+            t->next_tick += t->period;
+            t->heap_tick = t->next_tick;
+            SiftDown(&s->tick_regs, 0);
+        }
+
+        CALL_DELEGATE_0(t->on_tick);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef MTI_USE_EPOLL
+/* Adds a new registration to epoll and sets its epoll_fd */
+static void AddEpollEvent(MTI_EventQueue* s, MTI_SocketEvent* se, struct epoll_event* ev)
+{
+    se->epoll_fd = se->socket;
+
+    if (epoll_ctl(s->epoll, EPOLL_CTL_ADD, se->epoll_fd, ev) == 0) {
+        return;
+    }
+
+    if (errno == EEXIST) {
+        /* epoll only takes each fd once, but will take a dup of it */
+        se->epoll_fd = dup(se->socket);
+
+        if (se->epoll_fd >= 0 && epoll_ctl(s->epoll, EPOLL_CTL_ADD, se->epoll_fd, ev) == 0) {
+            return;
+        }
+
+        if (se->epoll_fd >= 0) {
+            close(se->epoll_fd);
+        }
+    }
+
+    /* eg EPERM for regular files */
+    se->epoll_fd = -1;
+    s->unpolled++;
+}
+#endif
+
 /* ------------------------------------------------------------------------- */
 
 static MT_Event* NewSocketEvent(
@@ -148,6 +525,7 @@ static MT_Event* NewSocketEvent(
     VoidDelegate         close,
     VoidDelegate         accept)
 {
+    MTI_SocketEvent* se;
     MT_Event* r;
     MTI_Event* e;
 
@@ -163,13 +541,16 @@ static MT_Event* NewSocketEvent(
     }
 #endif
 
-    r               = NEW(MT_Event);
+    se              = (MTI_SocketEvent*) SlabAlloc(&s->socket_slab);
+    se->socket      = sock;
+    se->on_read     = read;
+    se->on_write    = write;
+    se->on_close    = close;
+    se->on_accept   = accept;
+
+    r               = &se->event;
     r->event_queue  = s;
-    r->socket       = sock;
-    r->on_read      = read;
-    r->on_write     = write;
-    r->on_close     = close;
-    r->on_accept    = accept;
+    r->regnum       = s->socket_regs.size;
     r->enabled      = true;
 
     e = dv_append_zeroed(&s->events, 1);
@@ -192,9 +573,9 @@ static MT_Event* NewSocketEvent(
 
     {
 #ifdef _WIN32
-        r->handle = WSACreateEvent();
-        dv_insert2(&s->handles, s->socket_regs.size, &r->handle, 1);
-        WSAEventSelect(sock, r->handle, e->events);
+        se->handle = WSACreateEvent();
+        dv_insert2(&s->handles, s->socket_regs.size, &se->handle, 1);
+        WSAEventSelect(sock, se->handle, e->events);
 #else
         int flags = fcntl(sock, F_GETFL);
         fcntl(sock, F_SETFL, flags | O_NONBLOCK);
@@ -202,6 +583,16 @@ static MT_Event* NewSocketEvent(
 #endif
     }
 
+#ifdef MTI_USE_EPOLL
+    if (s->epoll >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = e->events;
+        ev.data.ptr = se;
+        AddEpollEvent(s, se, &ev);
+    }
+#endif
+
     dv_append2(&s->socket_regs, &r, 1);
 
     return r;
@@ -209,6 +600,53 @@ static MT_Event* NewSocketEvent(
 
 /* ------------------------------------------------------------------------- */
 
+/* Moves a socket registration and its event to a new slot in the socket
+ * tables. The old slot is left as is.
+ */
+static void MoveSocketEvent(MTI_EventQueue* s, int from, int to)
+{
+    MT_Event* r = s->socket_regs.data[from];
+
+    if (from == to) {
+        return;
+    }
+
+    s->socket_regs.data[to] = r;
+    s->events.data[to] = s->events.data[from];
+#ifdef _WIN32
+    s->handles.data[to] = s->handles.data[from];
+#endif
+    r->regnum = to;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Pushes a change to the events we are interested in through to the OS */
+static void UpdateSocketEvent(MTI_EventQueue* s, MTI_SocketEvent* se)
+{
+#ifdef MTI_USE_EPOLL
+    if (s->epoll >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = s->events.data[se->event.regnum].events;
+        ev.data.ptr = se;
+
+        if (se->edge_triggered) {
+            ev.events |= EPOLLET;
+        }
+
+        if (se->epoll_fd >= 0) {
+            epoll_ctl(s->epoll, EPOLL_CTL_MOD, se->epoll_fd, &ev);
+        }
+    }
+#else
+    (void) s;
+    (void) se;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
 MT_Event* MT_NewClientSocketEvent(MT_Socket sock, VoidDelegate read, VoidDelegate write, VoidDelegate close)
 {
     VoidDelegate null = NULL_DELEGATE;
@@ -240,7 +678,7 @@ MT_Event* MT_NewServerSocketEvent(MT_Socket sock, VoidDelegate accept)
 #ifdef _WIN32
 MT_Event* MTI_NewHandleEvent(MTI_EventQueue* s, MT_Handle h, VoidDelegate cb)
 {
-    MT_Event* r;
+    MTI_HandleEvent* he;
 
     assert(s && cb.func);
 
@@ -248,15 +686,15 @@ MT_Event* MTI_NewHandleEvent(MTI_EventQueue* s, MT_Handle h, VoidDelegate cb)
         return NULL;
     }
 
-    r               = NEW(MT_Event);
-    r->event_queue  = s;
-    r->type         = MTI_HANDLE;
-    r->handle       = h;
-    r->on_handle    = cb;
+    he                      = (MTI_HandleEvent*) SlabAlloc(&s->handle_slab);
+    he->event.event_queue   = s;
+    he->event.type          = MTI_HANDLE;
+    he->handle              = h;
+    he->on_handle           = cb;
 
-    MT_EnableEvent(r, MT_EVENT_HANDLE);
+    MT_EnableEvent(&he->event, MT_EVENT_HANDLE);
 
-    return r;
+    return &he->event;
 }
 
 #else
@@ -280,43 +718,131 @@ MT_Event* MT_NewHandleEvent(MT_Handle h, VoidDelegate cb)
 
 MT_Event* MT_NewTickEvent(MT_Time period, VoidDelegate cb)
 {
-    MT_Event* r;
+    MTI_TickEvent* t;
+    MTI_EventQueue* s = CreateCurrentEventQueue();
 
     assert(cb.func && period > 0);
 
-    r               = NEW(MT_Event);
-    r->event_queue  = CreateCurrentEventQueue();
-    r->type         = MTI_TICK;
-    r->period       = period;
-    r->on_tick      = cb;
+    t                       = (MTI_TickEvent*) SlabAlloc(&s->tick_slab);
+    t->event.event_queue    = s;
+    t->event.type           = MTI_TICK;
+    t->event.regnum         = -1;
+    t->period               = period;
+    t->on_tick              = cb;
 
-    MT_EnableEvent(r, MT_EVENT_TICK);
+    MT_EnableEvent(&t->event, MT_EVENT_TICK);
 
-    return r;
+    return &t->event;
+}
+
+/* ------------------------------------------------------------------------- */
+
+MT_Event* MT_NewTimeoutEvent(MT_Time deadline, VoidDelegate cb)
+{
+    MTI_TickEvent* t;
+    MTI_EventQueue* s = CreateCurrentEventQueue();
+
+    assert(cb.func && MT_TIME_ISVALID(deadline));
+
+    t                       = (MTI_TickEvent*) SlabAlloc(&s->tick_slab);
+    t->event.event_queue    = s;
+    t->event.type           = MTI_TIMEOUT;
+    t->event.regnum         = -1;
+    t->next_tick            = deadline;
+    t->on_tick              = cb;
+
+    MT_EnableEvent(&t->event, MT_EVENT_TICK);
+
+    return &t->event;
 }
 
 /* ------------------------------------------------------------------------- */
 
 MT_Event* MT_NewIdleEvent(VoidDelegate cb)
 {
-    MT_Event* r;
+    MTI_IdleEvent* ie;
+    MTI_EventQueue* s = CreateCurrentEventQueue();
 
     assert(cb.func);
 
-    r               = NEW(MT_Event);
-    r->event_queue  = CreateCurrentEventQueue();
-    r->type         = MTI_IDLE;
-    r->on_idle      = cb;
+    ie                      = (MTI_IdleEvent*) SlabAlloc(&s->idle_slab);
+    ie->event.event_queue   = s;
+    ie->event.type          = MTI_IDLE;
+    ie->on_idle             = cb;
 
-    MT_EnableEvent(r, MT_EVENT_IDLE);
+    MT_EnableEvent(&ie->event, MT_EVENT_IDLE);
 
-    return r;
+    return &ie->event;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Dispatches one of the pending events on a socket registration. Returns
+ * non-zero if a callback was called.
+ */
+static int DispatchSocketEvent(MTI_SocketEvent* se, MTI_Event* e)
+{
+    if (se->event.type == MTI_CLIENT_SOCKET) {
+        if ((e->revents & FD_READ) && (e->events & FD_READ) && se->on_read.func) {
+            e->revents &= ~FD_READ;
+            CALL_DELEGATE_0(se->on_read);
+            return 1;
+        }
+
+        if ((e->revents & FD_CLOSE) && (e->events & FD_CLOSE) && se->on_close.func) {
+            e->revents &= ~FD_CLOSE;
+            CALL_DELEGATE_0(se->on_close);
+            return 1;
+        }
+
+        if ((e->revents & FD_WRITE) && (e->events & FD_WRITE) && se->on_write.func) {
+            e->revents &= ~FD_WRITE;
+            CALL_DELEGATE_0(se->on_write);
+            return 1;
+        }
+
+    } else {
+        assert(se->event.type == MTI_SERVER_SOCKET);
+        assert((e->revents & FD_CLOSE) == 0);
+
+        if ((e->revents & FD_ACCEPT) && (e->events & FD_ACCEPT) && se->on_accept.func) {
+            e->revents &= ~FD_ACCEPT;
+            CALL_DELEGATE_0(se->on_accept);
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
 /* ------------------------------------------------------------------------- */
 
+#ifdef MTI_USE_EPOLL
+static int HandleEpollEvent(MTI_EventQueue* s)
+{
+    /* Only the registrations that epoll returned as ready are visited */
+    while (s->next_ready < s->ready.size) {
+        MTI_SocketEvent* se = (MTI_SocketEvent*) s->ready.data[s->next_ready].data.ptr;
+
+        if (se && DispatchSocketEvent(se, &s->events.data[se->event.regnum])) {
+            return 1;
+        }
+
+        s->next_ready++;
+    }
+
+    return 0;
+}
+#endif
+
 static int HandleEvent(MTI_EventQueue* s)
 {
+#ifdef MTI_USE_EPOLL
+    if (s->epoll >= 0) {
+        return HandleEpollEvent(s);
+    }
+#endif
+
     /* Win32 will only ever have one pending event at a time */
 #ifdef _WIN32
     if (0 <= s->next_event && s->next_event < s->events.size)
@@ -325,36 +851,10 @@ static int HandleEvent(MTI_EventQueue* s)
 #endif
     {
         MTI_Event* e = &s->events.data[s->next_event];
-        MT_Event* r = s->socket_regs.data[s->next_event];
-
-        if (r->type == MTI_CLIENT_SOCKET) {
-            if ((e->revents & FD_READ) && (e->events & FD_READ) && r->on_read.func) {
-                e->revents &= ~FD_READ;
-                CALL_DELEGATE_0(r->on_read);
-                return 1;
-            }
-
-            if ((e->revents & FD_CLOSE) && (e->events & FD_CLOSE) && r->on_close.func) {
-                e->revents &= ~FD_CLOSE;
-                CALL_DELEGATE_0(r->on_close);
-                return 1;
-            }
+        MTI_SocketEvent* se = SOCKET_EVENT(s->socket_regs.data[s->next_event]);
 
-            if ((e->revents & FD_WRITE) && (e->events & FD_WRITE) && r->on_write.func) {
-                e->revents &= ~FD_WRITE;
-                CALL_DELEGATE_0(r->on_write);
-                return 1;
-            }
-
-        } else {
-            assert(r->type == MTI_SERVER_SOCKET);
-            assert((e->revents & FD_CLOSE) == 0);
-
-            if ((e->revents & FD_ACCEPT) && (e->events & FD_ACCEPT) && r->on_accept.func) {
-                e->revents &= ~FD_ACCEPT;
-                CALL_DELEGATE_0(r->on_accept);
-                return 1;
-            }
+        if (DispatchSocketEvent(se, e)) {
+            return 1;
         }
 
 #ifdef _WIN32
@@ -376,7 +876,7 @@ static int GetNewEvents(MTI_EventQueue* s, MT_Time timeout)
     DWORD time = INFINITE;
 
     if (MT_TIME_ISVALID(timeout)) {
-        time = (DWORD) MT_TIME_TO_MS(timeout);
+        time = (DWORD) MT_TIME_TO_MS(timeout + MT_TIME_FROM_MS(1) - 1);
     }
 
     ret = WaitForMultipleObjects(
@@ -388,22 +888,21 @@ static int GetNewEvents(MTI_EventQueue* s, MT_Time timeout)
     if (0 <= ret && ret < (DWORD) s->socket_regs.size) {
         /* A socket was signalled */
         WSANETWORKEVENTS events;
-        MT_Event* r = s->socket_regs.data[ret];
+        MTI_SocketEvent* se = SOCKET_EVENT(s->socket_regs.data[ret]);
         MTI_Event* e = &s->events.data[ret];
 
-        if (WSAEnumNetworkEvents(r->socket, r->handle, &events)) {
+        if (WSAEnumNetworkEvents(se->socket, se->handle, &events)) {
             return 1;
         }
 
         e->revents = events.lNetworkEvents;
         s->next_event = ret;
-        HandleEvent(s);
         return 1;
 
     } else if (ret < (DWORD) s->handles.size) {
         /* A handle was signalled */
-        MT_Event* r = s->handle_regs.data[ret - s->socket_regs.size];
-        CALL_DELEGATE_0(r->on_handle);
+        MTI_HandleEvent* he = HANDLE_EVENT(s->handle_regs.data[ret - s->socket_regs.size]);
+        CALL_DELEGATE_0(he->on_handle);
         return 1;
 
     } else if (ret == WAIT_TIMEOUT) {
@@ -416,14 +915,77 @@ static int GetNewEvents(MTI_EventQueue* s, MT_Time timeout)
 }
 
 #else
+#ifdef MTI_USE_EPOLL
+static int GetNewEpollEvents(MTI_EventQueue* s, int timeoutms)
+{
+    int i, ret;
+
+    /* Registrations that epoll can't wait on are always ready, as poll
+     * reports them, so we must not block if any of them want an event.
+     */
+    for (i = 0; i < s->socket_regs.size && s->unpolled > 0; i++) {
+        MTI_SocketEvent* se = SOCKET_EVENT(s->socket_regs.data[i]);
+
+        if (se->epoll_fd < 0 && s->events.data[i].events) {
+            timeoutms = 0;
+            break;
+        }
+    }
+
+    dv_resize(&s->ready, MTI_EPOLL_EVENTS);
+    ret = epoll_wait(s->epoll, s->ready.data, MTI_EPOLL_EVENTS, timeoutms);
+    s->ready.size = ret > 0 ? ret : 0;
+    s->next_ready = 0;
+
+    for (i = 0; i < s->socket_regs.size && s->unpolled > 0; i++) {
+        MTI_SocketEvent* se = SOCKET_EVENT(s->socket_regs.data[i]);
+        short events = s->events.data[i].events & (FD_READ | FD_WRITE);
+
+        if (se->epoll_fd < 0 && events) {
+            struct epoll_event* ev = dv_append_zeroed(&s->ready, 1);
+            ev->events = events;
+            ev->data.ptr = se;
+            ret = (ret > 0 ? ret : 0) + 1;
+        }
+    }
+
+    if (ret < 0) {
+        /* error */
+        return 1;
+
+    } else if (ret == 0) {
+        /* timeout */
+        return 0;
+
+    } else {
+        /* Copy the returned events into the registration's event so that the
+         * dispatch and MT_DisableEvent/MT_ResetEvent work the same as poll.
+         */
+        for (i = 0; i < ret; i++) {
+            MTI_SocketEvent* se = (MTI_SocketEvent*) s->ready.data[i].data.ptr;
+            s->events.data[se->event.regnum].revents = (short) s->ready.data[i].events;
+        }
+
+        return 1;
+    }
+}
+#endif
+
 static int GetNewEvents(MTI_EventQueue* s, MT_Time timeout)
 {
     int ret;
     int timeoutms = -1;
 
     if (MT_TIME_ISVALID(timeout)) {
-        timeoutms = MT_TIME_TO_MS(timeout);
+        /* Round up so that we don't wake up just before the tick expires */
+        timeoutms = (int) MT_TIME_TO_MS(timeout + MT_TIME_FROM_MS(1) - 1);
+    }
+
+#ifdef MTI_USE_EPOLL
+    if (s->epoll >= 0) {
+        return GetNewEpollEvents(s, timeoutms);
     }
+#endif
 
     ret = poll(s->events.data, s->events.size, timeoutms);
 
@@ -438,7 +1000,6 @@ static int GetNewEvents(MTI_EventQueue* s, MT_Time timeout)
     } else {
         /* One or more events have been returned */
         s->next_event = 0;
-        HandleEvent(s);
         return 1;
     }
 }
@@ -447,51 +1008,61 @@ static int GetNewEvents(MTI_EventQueue* s, MT_Time timeout)
 
 /* ------------------------------------------------------------------------- */
 
-static void StepEventQueue(MTI_EventQueue* s)
+/* Dispatches the socket events returned by the last OS wait followed by any
+ * expired ticks until there are none left or max_batch callbacks have been
+ * called. Returns the number of callbacks called.
+ */
+static int DispatchBatch(MTI_EventQueue* s, int max_batch)
 {
-    MT_Time current_time = MT_TIME_INVALID;
-    assert(s->events.size == s->socket_regs.size);
+    int calls = 0;
 
-    /* 1. Handle already known events */
-    if (s->next_event >= 0 && HandleEvent(s)) {
-        return;
+    while (calls < max_batch && !s->exit && HandleEvent(s)) {
+        calls++;
+    }
+
+    if (calls == max_batch || s->exit) {
+        return calls;
     }
 
     s->next_event = -1;
 
-    /* 2. Handle expired timeout */
     if (s->tick_regs.size > 0) {
-        MT_Event* r = s->tick_regs.data[0];
-        current_time = MT_CurrentTime();
+        /* Ticks that expire whilst the batch is running are picked up on the
+         * next call.
+         */
+        MT_Time now = LoopTime(s);
 
-        if (current_time >= r->next_tick) {
-            /* New insert position is the index in the range [1,num of regs)
-             * where we want to move the just expired reg to.
-             */
-            int insert_pos;
+        while (calls < max_batch && !s->exit && HandleTick(s, now)) {
+            calls++;
+        }
+    }
 
-            dv_erase(&s->tick_regs, 0, 1);
+    return calls;
+}
 
-            r->next_tick += r->period;
-            insert_pos = FindFirstGreaterOrEqual(&s->tick_regs, r->next_tick);
-            dv_insert2(&s->tick_regs, insert_pos, &r, 1);
+static void StepEventQueue(MTI_EventQueue* s, int max_batch)
+{
+    assert(s->events.size == s->socket_regs.size);
 
-            CALL_DELEGATE_0(r->on_tick);
-            return;
-        }
+    s->now = MT_TIME_INVALID;
+
+    /* 1. Handle already known events and expired ticks */
+    if (DispatchBatch(s, max_batch) || s->exit) {
+        return;
     }
 
     if (s->idle_regs.size > 0) {
-        /* 3. Get OS events with a 0 timeout */
+        /* 2. Get OS events with a 0 timeout */
         if (GetNewEvents(s, 0)) {
+            DispatchBatch(s, max_batch);
             return;
         }
 
-        /* 4. Handle idle */
+        /* 3. Handle idle */
         if (s->next_idle < s->idle_regs.size) {
-            MT_Event* r = s->idle_regs.data[s->next_idle];
+            MTI_IdleEvent* ie = IDLE_EVENT(s->idle_regs.data[s->next_idle]);
             s->next_idle++;
-            CALL_DELEGATE_0(r->on_idle);
+            CALL_DELEGATE_0(ie->on_idle);
             return;
         }
 
@@ -499,47 +1070,51 @@ static void StepEventQueue(MTI_EventQueue* s)
     }
 
     {
-        /* 5. Get OS events with a timeout and block */
+        /* 4. Get OS events with a timeout and block */
         MT_Time timeout = MT_TIME_INVALID;
 
-        if (s->tick_regs.size > 0) {
-            timeout = s->tick_regs.data[0]->next_tick - current_time;
-            assert(MT_TIME_ISVALID(current_time));
-            assert(MT_TIME_ISVALID(timeout) && timeout > 0);
-        }
+        if (s->spin_max > 0) {
+            if (SpinEventQueue(s)) {
+                /* Still poll the OS, otherwise a steady stream of messages
+                 * would keep the sockets from ever being checked. Anything
+                 * returned is dispatched by the next step.
+                 */
+                GetNewEvents(s, 0);
+                return;
+            }
 
-        if (GetNewEvents(s, timeout)) {
-            return;
+            /* The spin used up some of the time to the next tick */
+            s->now = MT_TIME_INVALID;
         }
-    }
 
-    {
-        /* 6. Handle expired timeout. No need to get current_time and check
-         * if the timeout has actually expired as the OS event block in #5
-         * should guarantee that the timeout has expired.
-         */
-        MT_Event* r = s->tick_regs.data[0];
-
-        /* New insert position is the index in the range [1,num of regs) where
-         * we want to move the just expired reg to.
-         */
-        int insert_pos;
-        
-        dv_erase(&s->tick_regs, 0, 1);
+        if (s->tick_regs.size > 0) {
+            timeout = s->tick_regs.data[0]->heap_tick - LoopTime(s);
+            assert(MT_TIME_ISVALID(timeout));
 
-        r->next_tick += r->period;
-        insert_pos = FindFirstGreaterOrEqual(&s->tick_regs, r->next_tick);
-        dv_insert2(&s->tick_regs, insert_pos, &r, 1);
+            if (timeout < 0) {
+                timeout = 0;
+            }
+        }
 
-        CALL_DELEGATE_0(r->on_tick);
-        return;
+        GetNewEvents(s, timeout);
+        s->now = MT_TIME_INVALID;
     }
+
+    /* 5. Handle the events returned by the OS and any ticks that expired
+     * whilst we were blocked. The first tick registration may have been reset
+     * in the mean time so we still need to check the time.
+     */
+    DispatchBatch(s, max_batch);
 }
 
+/* MT_StepEventLoop calls at most one callback */
 void MT_StepEventLoop(void)
 {
     MTI_EventQueue* eq = CreateCurrentEventQueue();
-    StepEventQueue(eq);
+    StepEventQueue(eq, 1);
+
+    /* The caller may do any amount of work before the next step */
+    eq->now = MT_TIME_INVALID;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -547,8 +1122,10 @@ void MT_StepEventLoop(void)
 void MT_EnableEvent(MT_Event* r, int flags)
 {
     MTI_Event* e = NULL;
+    MTI_SocketEvent* se;
+    MTI_TickEvent* t;
     MTI_EventQueue* s = r->event_queue;
-    int regnum;
+    short old;
 
 #ifndef _WIN32
 
@@ -562,10 +1139,9 @@ void MT_EnableEvent(MT_Event* r, int flags)
     case MTI_CLIENT_SOCKET:
     case MTI_SERVER_SOCKET:
 
-        dv_find(s->socket_regs, r, &regnum);
-
-        assert(regnum >= 0);
-        e = &s->events.data[regnum];
+        assert(s->socket_regs.data[r->regnum] == r);
+        e = &s->events.data[r->regnum];
+        old = e->events;
 
         if (flags & MT_EVENT_READ) {
             e->events |= FD_READ;
@@ -583,13 +1159,23 @@ void MT_EnableEvent(MT_Event* r, int flags)
             e->events |= FD_CLOSE;
         }
 
+        se = SOCKET_EVENT(r);
+
+        if ((flags & MT_EVENT_EDGE) && !se->edge_triggered) {
+            se->edge_triggered = true;
+            UpdateSocketEvent(s, se);
+
+        } else if (e->events != old) {
+            UpdateSocketEvent(s, se);
+        }
+
         break;
 
 #ifdef _WIN32
     case MTI_HANDLE:
 
         if (flags & MT_EVENT_HANDLE && !r->enabled) {
-            dv_append2(&s->handles, &r->handle, 1);
+            dv_append2(&s->handles, &HANDLE_EVENT(r)->handle, 1);
             dv_append2(&s->handle_regs, &r, 1);
             r->enabled = true;
         }
@@ -600,10 +1186,28 @@ void MT_EnableEvent(MT_Event* r, int flags)
     case MTI_TICK:
 
         if (flags & MT_EVENT_TICK && !r->enabled) {
-            int i;
-            r->next_tick = MT_CurrentTime() + r->period;
-            i = FindFirstGreaterOrEqual(&s->tick_regs, r->next_tick);
-            dv_insert2(&s->tick_regs, i, &r, 1);
+            t = TICK_EVENT(r);
+            t->next_tick = LoopTime(s) + t->period;
+            t->heap_tick = t->next_tick;
+            InsertTick(s, t);
+            r->enabled = true;
+        }
+
+        break;
+
+    case MTI_TIMEOUT:
+
+        if (flags & MT_EVENT_TICK && !r->enabled) {
+            t = TICK_EVENT(r);
+
+            if (r->regnum >= 0) {
+                /* Still in the heap as a dead entry */
+                s->dead_ticks--;
+            } else {
+                t->heap_tick = t->next_tick;
+                InsertTick(s, t);
+            }
+
             r->enabled = true;
         }
 
@@ -625,8 +1229,10 @@ void MT_EnableEvent(MT_Event* r, int flags)
 void MT_DisableEvent(MT_Event* r, int flags)
 {
     MTI_Event* e = NULL;
+    MTI_SocketEvent* se;
     MTI_EventQueue* s = r->event_queue;
     int regnum;
+    short old;
 
 #ifndef _WIN32
 
@@ -640,10 +1246,9 @@ void MT_DisableEvent(MT_Event* r, int flags)
     case MTI_CLIENT_SOCKET:
     case MTI_SERVER_SOCKET:
 
-        dv_find(s->socket_regs, r, &regnum);
-
-        assert(regnum >= 0);
-        e = &s->events.data[regnum];
+        assert(s->socket_regs.data[r->regnum] == r);
+        e = &s->events.data[r->regnum];
+        old = e->events;
 
         if (flags & MT_EVENT_READ) {
             e->events &= ~FD_READ;
@@ -661,6 +1266,16 @@ void MT_DisableEvent(MT_Event* r, int flags)
             e->events &= ~FD_CLOSE;
         }
 
+        se = SOCKET_EVENT(r);
+
+        if ((flags & MT_EVENT_EDGE) && se->edge_triggered) {
+            se->edge_triggered = false;
+            UpdateSocketEvent(s, se);
+
+        } else if (e->events != old) {
+            UpdateSocketEvent(s, se);
+        }
+
         e->revents = 0;
 
         break;
@@ -683,15 +1298,16 @@ void MT_DisableEvent(MT_Event* r, int flags)
     case MTI_TICK:
 
         if ((flags & MT_EVENT_TICK) && r->enabled) {
-            int i = FindFirstGreaterOrEqual(&s->tick_regs, r->next_tick);
+            RemoveTick(s, TICK_EVENT(r));
+            r->enabled = false;
+        }
 
-            while (s->tick_regs.data[i] != r) {
-                assert(r->next_tick == s->tick_regs.data[i]->next_tick);
-                i++;
-            }
+        break;
 
-            dv_erase(&s->tick_regs, i, 1);
-            r->enabled = false;
+    case MTI_TIMEOUT:
+
+        if ((flags & MT_EVENT_TICK) && r->enabled) {
+            KillTimeout(s, TICK_EVENT(r));
         }
 
         break;
@@ -716,11 +1332,41 @@ void MT_DisableEvent(MT_Event* r, int flags)
 
 /* ------------------------------------------------------------------------- */
 
+void MT_RearmEvent(MT_Event* r)
+{
+    MTI_EventQueue* s;
+    MTI_SocketEvent* se;
+
+    if (r == NULL) {
+        return;
+    }
+
+    s = r->event_queue;
+
+    switch (r->type) {
+    case MTI_CLIENT_SOCKET:
+    case MTI_SERVER_SOCKET:
+        assert(s->socket_regs.data[r->regnum] == r);
+        se = SOCKET_EVENT(r);
+
+        /* A MOD with the same mask requeues the fd if it's ready */
+        if (se->edge_triggered) {
+            UpdateSocketEvent(s, se);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
 void MT_ResetEvent(MT_Event* r)
 {
     MTI_Event* e = NULL;
+    MTI_TickEvent* t;
     MTI_EventQueue* s;
-    int regnum;
 
     if (r == NULL || !r->enabled) {
         return;
@@ -731,16 +1377,23 @@ void MT_ResetEvent(MT_Event* r)
     switch (r->type) {
     case MTI_CLIENT_SOCKET:
     case MTI_SERVER_SOCKET:
-        dv_find(s->socket_regs, r, &regnum);
-
-        assert(regnum >= 0);
-        e = &s->events.data[regnum];
+        assert(s->socket_regs.data[r->regnum] == r);
+        e = &s->events.data[r->regnum];
         e->revents = 0;
         break;
 
     case MTI_TICK:
-        MT_DisableEvent(r, MT_EVENT_TICK);
-        MT_EnableEvent(r, MT_EVENT_TICK);
+        /* The registration is left where it is in the heap and moved when it
+         * gets to the top (see HandleTick). This keeps a reset O(1) as it's
+         * called for every read and write on a buffered IO keepalive.
+         */
+        t = TICK_EVENT(r);
+        t->next_tick = LoopTime(s) + t->period;
+
+        if (t->next_tick < t->heap_tick) {
+            t->heap_tick = t->next_tick;
+            SiftUp(&s->tick_regs, r->regnum);
+        }
         break;
 
     default:
@@ -754,33 +1407,82 @@ void MT_FreeEvent(MT_Event* r)
 {
     if (r) {
         MTI_EventQueue* s = r->event_queue;
-        int regnum;
+        MTI_SocketEvent* se;
+        MTI_TickEvent* t;
+        int regnum, last;
 
         switch (r->type) {
         case MTI_CLIENT_SOCKET:
         case MTI_SERVER_SOCKET:
 
-            dv_find(s->socket_regs, r, &regnum);
+            se = SOCKET_EVENT(r);
+            regnum = r->regnum;
+            last = s->socket_regs.size - 1;
+            assert(s->socket_regs.data[regnum] == r);
+
+#   ifdef MTI_USE_EPOLL
+            if (s->epoll >= 0) {
+                struct epoll_event ev;
+                int i;
 
-            if (regnum >= 0) {
-                dv_erase(&s->socket_regs, regnum, 1);
-                dv_erase(&s->events, regnum, 1);
+                /* Kernels before 2.6.9 require a non-NULL event for DEL */
+                memset(&ev, 0, sizeof(ev));
 
-#           ifdef _WIN32
-                dv_erase(&s->handles, regnum, 1);
-                CloseHandle(r->handle);
+                if (se->epoll_fd < 0) {
+                    s->unpolled--;
+                } else {
+                    epoll_ctl(s->epoll, EPOLL_CTL_DEL, se->epoll_fd, &ev);
 
-                if (s->next_event == regnum) {
-                    s->next_event = -1;
+                    if (se->epoll_fd != se->socket) {
+                        close(se->epoll_fd);
+                    }
                 }
-#           else
-                if (s->next_event > regnum) {
-                    s->next_event--;
+
+                /* Drop any events that haven't been dispatched yet */
+                for (i = s->next_ready; i < s->ready.size; i++) {
+                    if (s->ready.data[i].data.ptr == se) {
+                        s->ready.data[i].data.ptr = NULL;
+                    }
                 }
-#           endif
+            }
+#   endif
 
+            /* The slot is filled with the last registration so that removal
+             * doesn't have to shift the tables.
+             */
+#   ifdef _WIN32
+            CloseHandle(se->handle);
+
+            if (s->next_event == regnum) {
+                s->next_event = -1;
+            } else if (s->next_event == last) {
+                s->next_event = regnum;
             }
 
+            MoveSocketEvent(s, last, regnum);
+
+            /* Only shifts the handle_regs handles */
+            dv_erase(&s->handles, last, 1);
+#   else
+            if (0 <= s->next_event && s->next_event <= last && regnum < s->next_event) {
+                /* HandleEvent has already gone past this slot. Move the hole
+                 * up to next_event so that the last registration, which
+                 * hasn't been visited yet, isn't moved behind it.
+                 */
+                int next = s->next_event;
+                MoveSocketEvent(s, next - 1, regnum);
+                MoveSocketEvent(s, next, next - 1);
+                s->next_event = next - 1;
+                regnum = next;
+            }
+
+            MoveSocketEvent(s, last, regnum);
+#   endif
+
+            dv_erase_end(&s->socket_regs, 1);
+            dv_erase_end(&s->events, 1);
+
+            SlabFree(&s->socket_slab, se);
             break;
 
 #   ifdef _WIN32
@@ -793,21 +1495,34 @@ void MT_FreeEvent(MT_Event* r)
                 dv_erase(&s->handles, regnum + s->socket_regs.size, 1);
             }
 
+            SlabFree(&s->handle_slab, HANDLE_EVENT(r));
             break;
 #   endif
 
         case MTI_TICK:
 
+            t = TICK_EVENT(r);
+
             if (r->enabled) {
-                int i = FindFirstGreaterOrEqual(&s->tick_regs, r->next_tick);
+                RemoveTick(s, t);
+            }
 
-                /* i points to the first tick_reg with a next_tick == r->next_tick */
-                while (s->tick_regs.data[i] != r) {
-                    assert(r->next_tick == s->tick_regs.data[i]->next_tick);
-                    i++;
-                }
+            SlabFree(&s->tick_slab, t);
+            break;
 
-                dv_erase(&s->tick_regs, i, 1);
+        case MTI_TIMEOUT:
+
+            t = TICK_EVENT(r);
+
+            if (r->enabled) {
+                KillTimeout(s, t);
+            }
+
+            /* KillTimeout may have compacted the heap */
+            if (r->regnum >= 0) {
+                t->freed = true;
+            } else {
+                RecycleTimeout(s, t);
             }
 
             break;
@@ -824,9 +1539,8 @@ void MT_FreeEvent(MT_Event* r)
                 }
             }
 
+            SlabFree(&s->idle_slab, IDLE_EVENT(r));
             break;
         }
-
-        free(r);
     }
 }
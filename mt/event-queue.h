@@ -35,6 +35,17 @@
 #include <poll.h>
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 9)
+#define MTI_USE_EPOLL
+#endif
+#endif
+
+#endif
+
 #include "mt-internal.h"
 #include "wakeup-event.h"
 #include <mt/message.h>
@@ -57,12 +68,19 @@ typedef struct pollfd MTI_Event;
 
 #endif
 
+/* Maximum number of ready events pulled out of epoll in a single wait */
+#define MTI_EPOLL_EVENTS 256
+
+/* The adaptive spin never drops below spin_max / MTI_SPIN_MIN_DIVISOR + 1 */
+#define MTI_SPIN_MIN_DIVISOR 16
+
 /* ------------------------------------------------------------------------- */
 
 enum MTI_RegistrationType {
     MTI_CLIENT_SOCKET,
     MTI_SERVER_SOCKET,
     MTI_TICK,
+    MTI_TIMEOUT,
     MTI_IDLE
 
 #ifdef _WIN32
@@ -72,43 +90,157 @@ enum MTI_RegistrationType {
 
 /* ------------------------------------------------------------------------- */
 
+/* Common header for all registrations. Each registration type embeds this as
+ * its first member so that it only carries the fields it needs.
+ */
 struct MT_Event {
     enum MTI_RegistrationType       type;
     MTI_EventQueue*                 event_queue;
 
-    MT_Socket                       socket;
-
-    MT_Time                         period;
-    MT_Time                         next_tick;
+    /* Index into socket_regs and events for socket registrations and into
+     * tick_regs for tick registrations.
+     */
+    int                             regnum;
 
     bool                            enabled;
+};
+
+typedef struct MTI_SocketEvent MTI_SocketEvent;
+typedef struct MTI_TickEvent MTI_TickEvent;
+typedef struct MTI_IdleEvent MTI_IdleEvent;
+
+/* MTI_CLIENT_SOCKET and MTI_SERVER_SOCKET */
+struct MTI_SocketEvent {
+    MT_Event                        event;
+    MT_Socket                       socket;
 
     VoidDelegate                    on_read;
     VoidDelegate                    on_write;
     VoidDelegate                    on_close;
     VoidDelegate                    on_accept;
-    VoidDelegate                    on_idle;
+
+    /* Set by MT_EVENT_EDGE */
+    bool                            edge_triggered;
+
+#ifdef MTI_USE_EPOLL
+    /* The fd registered with epoll. This is a dup of socket if socket is
+     * already registered or -1 if epoll doesn't support it (eg regular
+     * files), in which case it is always reported as ready like poll does.
+     */
+    int                             epoll_fd;
+#endif
+
+#ifdef _WIN32
+    MT_Handle                       handle;
+#endif
+};
+
+/* MTI_TICK and MTI_TIMEOUT */
+struct MTI_TickEvent {
+    MT_Event                        event;
+
+    /* Ticks fire every period. Timeouts have no period and fire once at
+     * next_tick.
+     */
+    MT_Time                         period;
+    MT_Time                         next_tick;
+
+    /* The time the registration is sorted by in tick_regs. This is less than
+     * next_tick if the event has been reset since it was added to the heap.
+     */
+    MT_Time                         heap_tick;
+
+    /* Set when a timeout is freed whilst it is still in tick_regs. It is
+     * returned to the slab once it gets to the top of the heap.
+     */
+    bool                            freed;
+
     VoidDelegate                    on_tick;
+};
+
+/* MTI_IDLE */
+struct MTI_IdleEvent {
+    MT_Event                        event;
+    VoidDelegate                    on_idle;
+};
 
 #ifdef _WIN32
+typedef struct MTI_HandleEvent MTI_HandleEvent;
+
+/* MTI_HANDLE */
+struct MTI_HandleEvent {
+    MT_Event                        event;
     MT_Handle                       handle;
     VoidDelegate                    on_handle;
+};
 #endif
+
+/* ------------------------------------------------------------------------- */
+
+/* Fixed size allocator for the registrations. Objects are carved out of
+ * chunks of MTI_SLAB_OBJECTS and freed objects are kept on an intrusive free
+ * list for reuse. The chunks are only freed when the event queue is
+ * destroyed.
+ */
+
+#define MTI_SLAB_OBJECTS 64
+
+typedef struct MTI_EventSlab MTI_EventSlab;
+
+DVECTOR_INIT(SlabChunk, char*);
+
+struct MTI_EventSlab {
+    size_t                      object_size;
+
+    /* Number of objects that have been carved out of the last chunk */
+    int                         used;
+
+    void*                       free_list;
+    d_Vector(SlabChunk)         chunks;
 };
 
 /* ------------------------------------------------------------------------- */
 
 DVECTOR_INIT(EventRegistration, MT_Event*);
+DVECTOR_INIT(TickRegistration, MTI_TickEvent*);
 DVECTOR_INIT(Event, MTI_Event);
 DVECTOR_INIT(Handle, MT_Handle);
 
+#ifdef MTI_USE_EPOLL
+DVECTOR_INIT(EpollEvent, struct epoll_event);
+#endif
+
 struct MTI_EventQueue {
     bool                        exit;
 
+    /* The message queue we are embedded in */
+    MT_MessageQueue*            message_queue;
+
+    /* Busy wait before blocking (see MT_SetEventLoopSpin). spin_max is 0 if
+     * disabled. spin_limit is the current length of the spin.
+     */
+    int                         spin_max;
+    int                         spin_limit;
+
+    /* Cached loop time or MT_TIME_INVALID if it needs to be read */
+    MT_Time                     now;
+
     d_Vector(EventRegistration) socket_regs;
 
-    /* Kept sorted by next_tick field */
-    d_Vector(EventRegistration) tick_regs;
+    /* 4-ary min heap sorted by the heap_tick field */
+    d_Vector(TickRegistration)  tick_regs;
+
+    /* Disabled or freed timeouts are left in tick_regs and removed lazily.
+     * dead_ticks is the number of them still in the heap.
+     */
+    int                         dead_ticks;
+
+    MTI_EventSlab               socket_slab;
+    MTI_EventSlab               tick_slab;
+    MTI_EventSlab               idle_slab;
+#ifdef _WIN32
+    MTI_EventSlab               handle_slab;
+#endif
 
     d_Vector(EventRegistration) idle_regs;
     int                         next_idle;
@@ -117,6 +249,21 @@ struct MTI_EventQueue {
     d_Vector(Event)             events;
     int                         next_event;
 
+#ifdef MTI_USE_EPOLL
+    /* epoll handle or -1 if we have fallen back to poll */
+    int                         epoll;
+
+    /* Events returned by the last epoll_wait. The data.ptr field is the
+     * MTI_SocketEvent which is set to NULL if the registration is freed before the
+     * event is dispatched.
+     */
+    d_Vector(EpollEvent)        ready;
+    int                         next_ready;
+
+    /* Number of registrations with an epoll_fd of -1 */
+    int                         unpolled;
+#endif
+
 #ifdef _WIN32
     /* Handles are redirected to a socket on unix */
     d_Vector(EventRegistration) handle_regs;
@@ -34,6 +34,20 @@
 
 /* ------------------------------------------------------------------------- */
 
+#ifdef MTI_THREAD_LOCAL
+MTI_THREAD_LOCAL MT_MessageQueue* MTI_current_message_queue;
+
+void MT_SetCurrentMessageQueue(MT_MessageQueue* s)
+{
+    MTI_current_message_queue = s;
+}
+
+MT_MessageQueue* MT_CurrentMessageQueue(void)
+{
+    return MTI_current_message_queue;
+}
+
+#else
 static MT_ThreadStorage g_message_queue = MT_THREAD_STORAGE_INITIALIZER;
 
 void MT_SetCurrentMessageQueue(MT_MessageQueue* s)
@@ -45,6 +59,7 @@ MT_MessageQueue* MT_CurrentMessageQueue(void)
 {
     return (MT_MessageQueue*) MT_GetThreadStorage(&g_message_queue);
 }
+#endif
 
 /* ------------------------------------------------------------------------- */
 
@@ -65,7 +80,7 @@ static void FreeQueues(void)
 MT_MessageQueue* MTI_CreateCurrentMessageQueue(void)
 {
     static int atexit_ret = -1;
-    MT_MessageQueue* q = MT_CurrentMessageQueue();
+    MT_MessageQueue* q = MTI_CurrentMessageQueue();
 
     if (q) {
         return q;
@@ -91,7 +106,7 @@ MT_MessageQueue* MTI_CreateCurrentMessageQueue(void)
 
 MT_MessageQueue* MT_NewMessageQueue(void)
 {
-    MT_MessageQueue* s = NEW(MT_MessageQueue);
+    MT_MessageQueue* s = (MT_MessageQueue*) MTI_AlignedAlloc(sizeof(MT_MessageQueue));
     MT_Ref(s);
     MTI_InitEventQueue(&s->event_queue, s);
     return s;
@@ -99,16 +114,176 @@ MT_MessageQueue* MT_NewMessageQueue(void)
 
 /* ------------------------------------------------------------------------- */
 
-static MTI_MessagePart* CreateMessage(struct MTI_PipeHeader_void* ph, int parts, const void* data)
+static MTI_MessageRing* NewRing(int size)
+{
+    MTI_MessageRing* r = (MTI_MessageRing*) MTI_AlignedAlloc(sizeof(MTI_MessageRing));
+    long i;
+
+    /* The sequence numbers need at least two slots to tell a published slot
+     * from a free one.
+     */
+    long slots = 2;
+
+    while (slots < size) {
+        slots *= 2;
+    }
+
+    r->slots = (MTI_RingSlot*) MTI_AlignedAlloc(slots * sizeof(MTI_RingSlot));
+    r->mask = slots - 1;
+
+    for (i = 0; i < slots; i++) {
+        r->slots[i].sequence = i;
+    }
+
+    return r;
+}
+
+MT_MessageQueue* MT_NewMessageQueue2(int ring_size)
+{
+    MT_MessageQueue* s = MT_NewMessageQueue();
+
+    if (ring_size > 0) {
+        s->ring = NewRing(ring_size);
+    }
+
+    return s;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int MessageSizeClass(int size)
+{
+    int i;
+
+    for (i = 0; i < MTI_MESSAGE_CLASSES; i++) {
+        if (size <= (MTI_MESSAGE_MIN_SIZE << i)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Returns a free block to the pool. Only called on the owning thread. */
+static void PoolMessage(MT_MessageQueue* s, MTI_MessageHead* h)
+{
+    int c = h->size_class;
+
+    if (s->free_message_num[c] >= MTI_MESSAGE_POOL_MAX) {
+        free(h);
+        return;
+    }
+
+    h->free_item.next = s->free_messages[c] ? &s->free_messages[c]->free_item : NULL;
+    s->free_messages[c] = h;
+    s->free_message_num[c]++;
+}
+
+/* Moves blocks freed on other threads back into the pool. Only called on
+ * the owning thread.
+ */
+static void ReclaimMessages(MT_MessageQueue* s)
+{
+    for (;;) {
+        MTI_AtomicQueueItem* item = MTI_AtomicQueue_Consume(&s->returned_messages);
+
+        if (!item) {
+            break;
+        }
+
+        PoolMessage(s, container_of(item, MTI_MessageHead, free_item));
+    }
+}
+
+static void FreeMessagePool(MT_MessageQueue* s)
+{
+    int i;
+
+    ReclaimMessages(s);
+
+    for (i = 0; i < MTI_MESSAGE_CLASSES; i++) {
+        while (s->free_messages[i]) {
+            MTI_MessageHead* h = s->free_messages[i];
+            MTI_AtomicQueueItem* next = h->free_item.next;
+            s->free_messages[i] = next ? container_of(next, MTI_MessageHead, free_item) : NULL;
+            free(h);
+        }
+
+        s->free_message_num[i] = 0;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Allocates a message block from the current thread's pool. cur is the
+ * current message queue. Threads without one just use malloc.
+ */
+static MTI_MessageHead* AllocMessage(MT_MessageQueue* cur, int size)
+{
+    int c = MessageSizeClass(size);
+    MTI_MessageHead* h;
+
+    if (cur == NULL || c < 0) {
+        h = (MTI_MessageHead*) malloc(size);
+        h->owner = NULL;
+        return h;
+    }
+
+    if (!cur->free_messages[c]) {
+        ReclaimMessages(cur);
+    }
+
+    h = cur->free_messages[c];
+
+    if (h) {
+        MTI_AtomicQueueItem* next = h->free_item.next;
+        cur->free_messages[c] = next ? container_of(next, MTI_MessageHead, free_item) : NULL;
+        cur->free_message_num[c]--;
+    } else {
+        h = (MTI_MessageHead*) malloc(MTI_MESSAGE_MIN_SIZE << c);
+        h->size_class = c;
+    }
+
+    h->owner = cur;
+    MT_Ref(cur);
+    return h;
+}
+
+/* Blocks freed on the owning thread go straight back into its pool, those
+ * freed elsewhere are queued for the owner to pick up. cur is the current
+ * message queue or NULL if unknown.
+ */
+static void FreeMessage(MT_MessageQueue* cur, MTI_MessageHead* h)
+{
+    MT_MessageQueue* owner = h->owner;
+
+    if (owner == NULL) {
+        free(h);
+        return;
+    }
+
+    if (owner == cur) {
+        PoolMessage(owner, h);
+    } else {
+        MTI_AtomicQueue_Produce(&owner->returned_messages, &h->free_item);
+    }
+
+    MT_Deref(owner, MTI_DestroyMessageQueue(owner));
+}
+
+/* ------------------------------------------------------------------------- */
+
+static MTI_MessagePart* CreateMessage(MT_MessageQueue* cur, struct MTI_PipeHeader_void* ph, int parts, const void* data)
 {
     int i;
 
     int alloc = MTI_MESSAGE_HEAD_SIZE + ph->data_size + (parts * sizeof(MTI_MessagePart));
-    MTI_MessageHead* h = (MTI_MessageHead*) malloc(alloc);
+    MTI_MessageHead* h = AllocMessage(cur, alloc);
     MTI_MessagePart* p = (MTI_MessagePart*) ((char*) h + MTI_MESSAGE_HEAD_SIZE + ph->data_size);
 
     h->ref = 1;
     h->destroy_argument = ph->destroy;
+    h->targets = NULL;
 
     if (ph->init) {
         ph->init((char*) h + MTI_MESSAGE_HEAD_SIZE, data);
@@ -123,7 +298,7 @@ static MTI_MessagePart* CreateMessage(struct MTI_PipeHeader_void* ph, int parts,
     return p;
 }
 
-static void DerefMessage(MTI_MessageHead* h)
+static void DerefMessage(MT_MessageQueue* cur, MTI_MessageHead* h)
 {
     if (h && MT_AtomicDecrement(&h->ref) == 0) {
 
@@ -131,12 +306,86 @@ static void DerefMessage(MTI_MessageHead* h)
             h->destroy_argument((char*) h + MTI_MESSAGE_HEAD_SIZE);
         }
 
-        free(h);
+        if (h->targets) {
+            MT_Deref(h->targets, MTI_FreeDelegateVector(h->targets));
+        }
+
+        FreeMessage(cur, h);
+    }
+}
+
+/* Drops the message references we have been holding on to for a run of
+ * messages to the same target.
+ */
+static void DerefWeakMessages(MT_WeakData* wd, long count)
+{
+    if (wd && MT_AtomicSubtract(&wd->msg_ref, count) == 0) {
+        free(wd);
     }
 }
 
+/* ------------------------------------------------------------------------- */
+
+/* Consumes the published messages in the ring calling their targets if call
+ * is set. Returns false if it stopped at a slot that a producer has claimed
+ * but not yet filled in.
+ */
+static bool ProcessRing(MTI_MessageRing* r, bool call)
+{
+    MT_WeakData* wd = NULL;
+    long wd_refs = 0;
+
+    for (;;) {
+        long pos = r->head;
+        MTI_RingSlot* slot = &r->slots[pos & r->mask];
+        MT_WeakData* slot_wd;
+
+        if (slot->sequence != pos + 1) {
+            break;
+        }
+
+        /* The argument was built in place by the pipe's init (eg a C++ copy
+         * constructor) so it can't be moved out of the slot. We move the
+         * head on before calling the target, so the target can process the
+         * queue again, but only hand the slot back to the producers once
+         * the argument has been destroyed.
+         */
+        MT_MemoryBarrier();
+        slot_wd = slot->weak_data;
+        r->head++;
+
+        if (call && slot_wd->object) {
+            CALL_DELEGATE_1(slot->dlg, slot->data);
+        }
+
+        if (slot->destroy_argument) {
+            slot->destroy_argument(slot->data);
+        }
+
+        MT_MemoryBarrier();
+        slot->sequence = pos + r->mask + 1;
+
+        if (slot_wd != wd) {
+            DerefWeakMessages(wd, wd_refs);
+            wd = slot_wd;
+            wd_refs = 0;
+        }
+
+        wd_refs++;
+    }
+
+    DerefWeakMessages(wd, wd_refs);
+    return r->tail == r->head;
+}
+
+/* ------------------------------------------------------------------------- */
+
 static void FreeQueuedMessages(MT_MessageQueue* s)
 {
+    if (s->ring) {
+        ProcessRing(s->ring, false);
+    }
+
     for (;;) {
 
         MTI_MessagePart* m;
@@ -150,8 +399,11 @@ static void FreeQueuedMessages(MT_MessageQueue* s)
         m = container_of(item, MTI_MessagePart, qitem);
         h = m->header;
 
-        MT_Deref2(m->weak_data, msg_ref, free(m->weak_data));
-        DerefMessage(h);
+        if (!m->group) {
+            MT_Deref2(m->weak_data, msg_ref, free(m->weak_data));
+        }
+
+        DerefMessage(NULL, h);
     }
 }
 
@@ -159,7 +411,16 @@ void MTI_DestroyMessageQueue(MT_MessageQueue* s)
 {
     FreeQueuedMessages(s);
     assert(!s->queue.first && !s->queue.last);
-    free(s);
+    assert(s->batch.size == 0);
+    dv_free(s->batch);
+    FreeMessagePool(s);
+
+    if (s->ring) {
+        MTI_AlignedFree(s->ring->slots);
+        MTI_AlignedFree(s->ring);
+    }
+
+    MTI_AlignedFree(s);
 }
 
 void MT_FreeMessageQueue(MT_MessageQueue* s)
@@ -177,7 +438,7 @@ void MT_SetMessageQueueWakeup(MT_MessageQueue* s, VoidDelegate wakeup)
 {
     s->wakeup = wakeup;
 
-    if (s->queue.first) {
+    if (s->queue.first || (s->ring && s->ring->tail != s->ring->head)) {
         MT_AtomicSet(&s->woken, 1);
         CALL_DELEGATE_0(s->wakeup);
     }
@@ -187,47 +448,316 @@ void MT_SetMessageQueueWakeup(MT_MessageQueue* s, VoidDelegate wakeup)
 
 void MT_ProcessMessageQueue(MT_MessageQueue* s)
 {
+    MT_MessageQueue* cur = MTI_CurrentMessageQueue();
+    MT_WeakData* wd = NULL;
+    long wd_refs = 0;
+    long overflow = 0;
+
     MT_AtomicSet(&s->woken, 0);
 
     for (;;) {
 
         MTI_MessagePart* m;
         MTI_MessageHead* h;
-        MTI_AtomicQueueItem* item = MTI_AtomicQueue_Consume(&s->queue);
+        MTI_AtomicQueueItem* item;
+
+        /* Large messages and signal emissions go to the list even whilst a
+         * sender's earlier messages are still in the ring, so the ring is
+         * drained before each list message. If a producer is still filling
+         * in a slot, anything it has sent after that may be in the list, so
+         * leave the list until the slot has been published. The producer
+         * wakes us up again once it is.
+         */
+        if (s->ring && !ProcessRing(s->ring, true)) {
+            break;
+        }
+
+        item = MTI_AtomicQueue_Consume(&s->queue);
 
         if (!item) {
             break;
         }
 
+        /* Start loading the next message whilst we dispatch this one */
+        MTI_PREFETCH(item->next);
+
         m = container_of(item, MTI_MessagePart, qitem);
         h = m->header;
+        overflow++;
+
+        if (m->group) {
+            /* Signal emission to several targets on this queue */
+            MTI_SignalReg* r = m->group;
+            int i, n = r->group_size;
+
+            for (i = 0; i < n; i++) {
+                if (r[i].weak_data->object) {
+                    CALL_DELEGATE_1(r[i].dlg, (char*) h + MTI_MESSAGE_HEAD_SIZE);
+                }
+            }
+
+            DerefMessage(cur, h);
+            continue;
+        }
 
         if (m->weak_data->object) {
             CALL_DELEGATE_1(m->dlg, (char*) h + MTI_MESSAGE_HEAD_SIZE);
         }
 
-        MT_Deref2(m->weak_data, msg_ref, free(m->weak_data));
-        DerefMessage(h);
+        /* Runs of messages to the same object are common with bulk
+         * producers so only drop the message refs when the target changes.
+         */
+        if (m->weak_data != wd) {
+            DerefWeakMessages(wd, wd_refs);
+            wd = m->weak_data;
+            wd_refs = 0;
+        }
+
+        wd_refs++;
+        DerefMessage(cur, h);
+    }
+
+    DerefWeakMessages(wd, wd_refs);
+
+    if (s->ring && overflow) {
+        MT_AtomicSubtract(&s->ring->overflow, overflow);
+    }
+}
+
+/* Returns true if messages have been published or are being published to
+ * the queue.
+ */
+static bool HaveMessages(MT_MessageQueue* s)
+{
+    return s->queue.last != NULL || (s->ring && s->ring->tail != s->ring->head);
+}
+
+bool MTI_SpinMessageQueue(MT_MessageQueue* s, int spins)
+{
+    int i;
+
+    /* Producers only signal the wakeup when they change woken from 0 to 1,
+     * so setting it ourselves stops them whilst we spin. If it is already
+     * set a wakeup is on its way and there is no point spinning.
+     */
+    if (MT_AtomicSetFrom(&s->woken, 0, 1) != 0) {
+        return false;
+    }
+
+    for (i = 0; i < spins; i++) {
+        if (HaveMessages(s)) {
+            MT_ProcessMessageQueue(s);
+            return true;
+        }
+
+        MTI_CPU_RELAX();
     }
+
+    /* Anything published before this exchange was not signalled so we
+     * need to check again before blocking. Anything after it will signal
+     * the wakeup.
+     */
+    MT_AtomicSet(&s->woken, 0);
+
+    if (HaveMessages(s)) {
+        MT_ProcessMessageQueue(s);
+        return true;
+    }
+
+    return false;
 }
 
 /* ------------------------------------------------------------------------- */
 
-static void ProxiedSend(MTI_MessagePart* p, MT_Delegate_void dlg, MT_WeakData* weak_data)
+static void WakeQueue(MT_MessageQueue* s)
 {
-    MT_MessageQueue* s = weak_data->message_queue;
+    if (MT_AtomicSetFrom(&s->woken, 0, 1) == 0) {
+        CALL_DELEGATE_0(s->wakeup);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns the batch chain for target in the current queue's batch */
+static MTI_BatchChain* BatchChain(MT_MessageQueue* cur, MT_MessageQueue* target)
+{
+    MTI_BatchChain* c;
+    int i;
+
+    for (i = cur->batch.size - 1; i >= 0; i--) {
+        if (cur->batch.data[i].queue == target) {
+            return &cur->batch.data[i];
+        }
+    }
+
+    c = dv_append_zeroed(&cur->batch, 1);
+    c->queue = target;
+    return c;
+}
 
+/* ------------------------------------------------------------------------- */
+
+/* Queues a filled in message part on s. cur is the current message queue,
+ * which may be NULL.
+ */
+static void QueuePart(MT_MessageQueue* cur, MT_MessageQueue* s, MTI_MessagePart* p)
+{
+    p->qitem.next = NULL;
+
+    if (s->ring) {
+        MT_AtomicIncrement(&s->ring->overflow);
+    }
+
+    if (cur && cur->batch_depth > 0) {
+        MTI_BatchChain* c = BatchChain(cur, s);
+
+        if (c->last) {
+            c->last->next = &p->qitem;
+        } else {
+            c->first = &p->qitem;
+        }
+
+        c->last = &p->qitem;
+
+    } else {
+        MTI_AtomicQueue_Produce(&s->queue, &p->qitem);
+        WakeQueue(s);
+    }
+}
+
+static void ProxiedSend(MT_MessageQueue* cur, MTI_MessagePart* p, MT_Delegate_void dlg, MT_WeakData* weak_data)
+{
     p->dlg = dlg;
     p->weak_data = weak_data;
-    p->qitem.next = NULL;
+    p->group = NULL;
 
     MT_Ref2(p->weak_data, msg_ref);
+    QueuePart(cur, weak_data->message_queue, p);
+}
 
-    MTI_AtomicQueue_Produce(&s->queue, &p->qitem);
+/* ------------------------------------------------------------------------- */
 
-    if (MT_AtomicSetFrom(&s->woken, 0, 1) == 0) {
-        CALL_DELEGATE_0(s->wakeup);
+void MT_BeginBatch(void)
+{
+    MT_MessageQueue* cur = MTI_CreateCurrentMessageQueue();
+    cur->batch_depth++;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void PublishChain(MTI_BatchChain* c)
+{
+    if (c->first) {
+        MTI_AtomicQueue_ProduceChain(&c->queue->queue, c->first, c->last);
+        c->first = c->last = NULL;
     }
+
+    WakeQueue(c->queue);
+}
+
+/* ------------------------------------------------------------------------- */
+
+void MT_FlushBatch(void)
+{
+    MT_MessageQueue* cur = MTI_CurrentMessageQueue();
+    int i;
+
+    assert(cur && cur->batch_depth > 0);
+
+    if (--cur->batch_depth > 0) {
+        return;
+    }
+
+    for (i = 0; i < cur->batch.size; i++) {
+        PublishChain(&cur->batch.data[i]);
+    }
+
+    dv_clear(&cur->batch);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Tries to copy the message into the target queue's ring. Returns false if
+ * the argument is too big for a slot or the ring is full.
+ */
+static bool RingSend(MT_MessageQueue* cur, struct MTI_PipeHeader_void* ph, MT_Delegate_void dlg, MT_WeakData* weak_data, const void* data)
+{
+    MT_MessageQueue* s = weak_data->message_queue;
+    MTI_MessageRing* r = s->ring;
+    MTI_RingSlot* slot;
+    long pos;
+
+    if (ph->data_size > MTI_RING_INLINE_SIZE) {
+        return false;
+    }
+
+    if (r->overflow > 0) {
+        goto congested;
+    }
+
+    pos = r->tail;
+
+    for (;;) {
+        long diff;
+        slot = &r->slots[pos & r->mask];
+        diff = (long) ((unsigned long) slot->sequence - (unsigned long) pos);
+
+        if (diff == 0) {
+            /* Slot is free, try and claim it */
+            long prev = MT_AtomicSetFrom(&r->tail, pos, pos + 1);
+
+            if (prev == pos) {
+                break;
+            }
+
+            pos = prev;
+
+        } else if (diff < 0) {
+            /* The consumer hasn't freed the slot from the last lap */
+            goto congested;
+
+        } else {
+            /* Another producer claimed it first */
+            pos = r->tail;
+        }
+    }
+
+    slot->dlg = dlg;
+    slot->weak_data = weak_data;
+    slot->destroy_argument = ph->destroy;
+
+    MT_Ref2(weak_data, msg_ref);
+
+    if (ph->init) {
+        ph->init(slot->data, data);
+    } else {
+        memcpy(slot->data, data, ph->data_size);
+    }
+
+    /* Publish the message to the consumer */
+    MT_MemoryBarrier();
+    slot->sequence = pos + 1;
+
+    if (cur && cur->batch_depth > 0) {
+        /* The message is visible straight away but we hold off on the
+         * wakeup until the batch is flushed.
+         */
+        BatchChain(cur, s);
+    } else {
+        WakeQueue(s);
+    }
+
+    return true;
+
+congested:
+    /* If we are in a batch the consumer may be waiting on us to publish our
+     * messages or wake it up before the ring can drain.
+     */
+    if (cur && cur->batch_depth > 0) {
+        PublishChain(BatchChain(cur, s));
+    }
+
+    return false;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -236,14 +766,15 @@ void MT_BaseSend(const void* channel, const void* argument)
 {
     MT_Pipe(void)* pch = (MT_Pipe(void)*) channel;
     MT_WeakData* p = pch->weak_data;
+    MT_MessageQueue* cur;
 
     if (p == NULL || p->object == NULL) {
         /* Do nothing */
-    } else if (p->message_queue == MT_CurrentMessageQueue()) {
+    } else if (p->message_queue == (cur = MTI_CurrentMessageQueue())) {
         CALL_DELEGATE_1(pch->dlg, (void*) argument);
-    } else  {
-        MTI_MessagePart* p = CreateMessage( &pch->h, 1, argument);
-        ProxiedSend(p, pch->dlg, pch->weak_data);
+    } else if (!p->message_queue->ring || !RingSend(cur, &pch->h, pch->dlg, p, argument)) {
+        MTI_MessagePart* p = CreateMessage(cur, &pch->h, 1, argument);
+        ProxiedSend(cur, p, pch->dlg, pch->weak_data);
     }
 }
 
@@ -254,8 +785,46 @@ void MT_BaseSendProxied(const void* channel, const void* argument)
     MT_Pipe(void)* pch = (MT_Pipe(void)*) channel;
 
     if (pch->weak_data && pch->weak_data->object) {
-        MTI_MessagePart* p = CreateMessage(&pch->h, 1, argument);
-        ProxiedSend(p, pch->dlg, pch->weak_data);
+        MT_WeakData* wd = pch->weak_data;
+        MT_MessageQueue* cur = MTI_CurrentMessageQueue();
+
+        if (!wd->message_queue->ring || !RingSend(cur, &pch->h, pch->dlg, wd, argument)) {
+            MTI_MessagePart* p = CreateMessage(cur, &pch->h, 1, argument);
+            ProxiedSend(cur, p, pch->dlg, wd);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+bool MT_BaseTrySend(const void* channel, const void* argument)
+{
+    MT_Pipe(void)* pch = (MT_Pipe(void)*) channel;
+    MT_WeakData* p = pch->weak_data;
+    MT_MessageQueue* cur;
+
+    if (p == NULL || p->object == NULL) {
+        /* Dropped as with MT_BaseSend */
+        return true;
+
+    } else if (p->message_queue == (cur = MTI_CurrentMessageQueue())) {
+        CALL_DELEGATE_1(pch->dlg, (void*) argument);
+        return true;
+
+    } else if (p->message_queue->ring) {
+        if (RingSend(cur, &pch->h, pch->dlg, p, argument)) {
+            return true;
+        } else if (pch->h.data_size <= MTI_RING_INLINE_SIZE) {
+            /* Back pressure */
+            return false;
+        }
+    }
+
+    {
+        /* No ring or the argument is too big for one */
+        MTI_MessagePart* m = CreateMessage(cur, &pch->h, 1, argument);
+        ProxiedSend(cur, m, pch->dlg, p);
+        return true;
     }
 }
 
@@ -265,55 +834,79 @@ void MT_BaseEmit(const void* psig, const void* argument)
 {
     MT_Signal(void)* sig = (MT_Signal(void)*) psig;
     MTI_DelegateVector* vec;
+    MTI_EpochRecord* epoch;
     MT_MessageQueue* cur_queue;
     MTI_MessageHead* header = NULL;
     MTI_MessagePart* msg = NULL;
-    int i;
+    int i, n;
 
     if (!sig->targets) {
         return;
     }
 
-    /* Grab a reference to the list of targets and then drop the lock so that
-     * we aren't holding the lock whilst calling the targets (some of which may
-     * be synchronous and may take infinite time or would otherwise deadlock on
-     * this signal).
+    /* The target list is only freed once we leave the epoch, so we can read
+     * it without the signal lock or a reference. Synchronous targets are
+     * free to connect to or disconnect from this signal.
      */
 
-    MT_Lock(&sig->lock);
-    vec = sig->targets;
-    MT_Ref(vec);
-    MT_Unlock(&sig->lock);
+    epoch = MTI_EnterSignalEpoch();
+    vec = *(MTI_DelegateVector* volatile*) &sig->targets;
 
     if (!vec) {
+        MTI_ExitSignalEpoch(epoch);
         return;
     }
 
-    cur_queue = MT_CurrentMessageQueue();
+    cur_queue = MTI_CurrentMessageQueue();
 
-    for (i = 0; i < vec->size; i++) {
+    /* Registrations are grouped by queue and send type, so each group is
+     * either called directly or proxied with a single queued part.
+     */
+    for (i = 0; i < vec->size; i += n) {
         MTI_SignalReg* r = &vec->regs[i];
-       
-        if (r->weak_data->object == NULL) {
-            /* Do nothing */
-        } else if (r->type == MT_SEND_DIRECT || (r->type == MT_SEND_AUTO && r->weak_data->message_queue == cur_queue)) {
-            CALL_DELEGATE_1(r->dlg, (void*) argument);
-        } else {
+        n = r->group_size;
+
+        if (r->type == MT_SEND_DIRECT || (r->type == MT_SEND_AUTO && r->weak_data->message_queue == cur_queue)) {
+            int j;
+
+            for (j = 0; j < n; j++) {
+                if (r[j].weak_data->object) {
+                    CALL_DELEGATE_1(r[j].dlg, (void*) argument);
+                }
+            }
+
+        } else if (n > 1 || r->weak_data->object) {
             if (!msg) {
                 /* Create a large enough message to hold parts for all the
                  * remaining registrations in case they are all proxied.
                  */
-                msg = CreateMessage(&sig->h, vec->size - i, argument);
+                msg = CreateMessage(cur_queue, &sig->h, vec->size - i, argument);
                 header = msg->header;
             }
 
             MT_AtomicIncrement(&header->ref);
-            ProxiedSend(msg++, r->dlg, r->weak_data);
+
+            if (n == 1) {
+                ProxiedSend(cur_queue, msg++, r->dlg, r->weak_data);
+                continue;
+            }
+
+            /* The part uses the registrations in vec so the message keeps
+             * it alive.
+             */
+            if (!header->targets) {
+                header->targets = vec;
+                MT_Ref(vec);
+            }
+
+            msg->weak_data = r->weak_data;
+            msg->group = r;
+            QueuePart(cur_queue, r->weak_data->message_queue, msg++);
         }
     }
 
-    DerefMessage(header);
-    MT_Deref(vec, MTI_FreeDelegateVector(vec));
+    DerefMessage(cur_queue, header);
+    MTI_ExitSignalEpoch(epoch);
 }
 
 
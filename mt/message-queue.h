@@ -32,27 +32,98 @@
 #include "event-queue.h"
 #include <mt/message.h>
 
+typedef struct MTI_MessageHead MTI_MessageHead;
+typedef struct MTI_MessagePart MTI_MessagePart;
+typedef struct MTI_MessageRing MTI_MessageRing;
+typedef struct MTI_RingSlot MTI_RingSlot;
+typedef struct MTI_BatchChain MTI_BatchChain;
+
+/* Messages queued up for one target queue in a batch (see MT_BeginBatch) */
+struct MTI_BatchChain {
+    MT_MessageQueue*        queue;
+    MTI_AtomicQueueItem*    first;
+    MTI_AtomicQueueItem*    last;
+};
+
+DVECTOR_INIT(BatchChain, MTI_BatchChain);
+
+/* Message blocks are pooled in size classes of MTI_MESSAGE_MIN_SIZE << class
+ * bytes. Bigger messages are malloced directly.
+ */
+#define MTI_MESSAGE_CLASSES     5
+#define MTI_MESSAGE_MIN_SIZE    64
+
+/* Maximum number of free blocks kept per size class */
+#define MTI_MESSAGE_POOL_MAX    512
+
+/* Laid out so that the fields written by producers (queue.last and woken)
+ * don't share cache lines with each other or with the fields the consumer
+ * writes (queue.first and the event queue). Allocated with MTI_AlignedAlloc.
+ */
 struct MT_MessageQueue {
-    MT_AtomicInt            ref;
     MTI_AtomicQueue         queue;
+
+    /* Message blocks from our pool that have been freed on other threads */
+    MTI_AtomicQueue         returned_messages;
+
     MT_AtomicInt            woken;
+    char                    woken_pad[MT_CACHE_LINE_SIZE - sizeof(MT_AtomicInt)];
+
+    /* Each message block allocated from our pool holds a ref */
+    MT_AtomicInt            ref;
+    char                    ref_pad[MT_CACHE_LINE_SIZE - sizeof(MT_AtomicInt)];
+
+    /* Read mostly */
     VoidDelegate            wakeup;
+
+    /* Optional bounded transport (see MT_NewMessageQueue2) or NULL */
+    MTI_MessageRing*        ring;
+
+    char                    shared_pad[MT_CACHE_LINE_SIZE - sizeof(VoidDelegate) - sizeof(MTI_MessageRing*)];
+
+    /* Only used on the consumer thread */
     MTI_EventQueue          event_queue;
-};
 
-typedef struct MTI_MessageHead MTI_MessageHead;
-typedef struct MTI_MessagePart MTI_MessagePart;
+    /* Sends from this thread whilst batch_depth > 0 are collected in batch
+     * and published when the outermost batch is flushed.
+     */
+    int                     batch_depth;
+    d_Vector(BatchChain)    batch;
+
+    /* Free message blocks for sends from this thread by size class */
+    MTI_MessageHead*        free_messages[MTI_MESSAGE_CLASSES];
+    int                     free_message_num[MTI_MESSAGE_CLASSES];
+};
 
 struct MTI_MessagePart {
     MTI_AtomicQueueItem qitem;
     MT_Delegate_void    dlg;
     MT_WeakData*        weak_data;
     MTI_MessageHead*    header;
+
+    /* Set when the part delivers a signal emission to a whole group of
+     * registrations on one queue (see MTI_SignalReg). dlg is then unused and
+     * weak_data is only used to find the queue and holds no message ref.
+     */
+    struct MTI_SignalReg* group;
 };
 
 struct MTI_MessageHead {
     MT_AtomicInt        ref;
     MT_Callback         destroy_argument;
+
+    /* Target list referenced by group parts or NULL. The message holds a
+     * ref on it.
+     */
+    MTI_DelegateVector* targets;
+
+    /* Queue whose pool the block belongs to or NULL if it was malloced */
+    MT_MessageQueue*    owner;
+    int                 size_class;
+
+    /* Links the block into a free list once it has been released */
+    MTI_AtomicQueueItem free_item;
+
     /* padding to align to 8 */
     /* argument data */
     /* padding to align to 8 */
@@ -62,6 +133,59 @@ struct MTI_MessageHead {
 /* size aligned to 8 */
 #define MTI_MESSAGE_HEAD_SIZE ((sizeof(MTI_MessageHead) + 7) & ~7)
 
+/* ------------------------------------------------------------------------- */
+
+/* Bounded multi producer single consumer ring. Each slot has a sequence
+ * number which tells producers and the consumer whose turn it is to use it
+ * (see Dmitry Vyukov's bounded queue). Messages whose argument fits in the
+ * slot are copied in without any allocation. Larger messages, signal
+ * emissions and sends that find the ring full go through the linked list
+ * queue instead.
+ */
+
+/* Slots are 128 bytes on 64 bit targets */
+#define MTI_RING_INLINE_SIZE 88
+
+struct MTI_RingSlot {
+    MT_AtomicInt            sequence;
+    MT_Delegate_void        dlg;
+    MT_WeakData*            weak_data;
+    MT_Callback             destroy_argument;
+    uint64_t                data[MTI_RING_INLINE_SIZE / 8];
+};
+
+struct MTI_MessageRing {
+    /* Next position to be claimed by a producer */
+    MT_AtomicInt            tail;
+
+    /* Number of messages for this queue that have gone through the linked
+     * list and not yet been consumed. Whilst there are any, producers also
+     * use the list so that messages from one thread stay in order.
+     */
+    MT_AtomicInt            overflow;
+    char                    producer_pad[MT_CACHE_LINE_SIZE - 2 * sizeof(MT_AtomicInt)];
+
+    /* Only touched by the consumer */
+    long                    head;
+    long                    mask;
+    MTI_RingSlot*           slots;
+};
+
+/* The current message queue for use within the library. With compiler TLS
+ * this is a single load rather than a call.
+ */
+#ifdef MTI_THREAD_LOCAL
+extern MTI_THREAD_LOCAL MT_MessageQueue* MTI_current_message_queue;
+#define MTI_CurrentMessageQueue() (MTI_current_message_queue)
+#else
+#define MTI_CurrentMessageQueue() MT_CurrentMessageQueue()
+#endif
+
 MT_MessageQueue* MTI_CreateCurrentMessageQueue(void);
 void MTI_DestroyMessageQueue(MT_MessageQueue* s);
 
+/* Busy waits for up to spins iterations for messages to arrive and
+ * processes them. Returns false if none arrived.
+ */
+bool MTI_SpinMessageQueue(MT_MessageQueue* s, int spins);
+
@@ -29,6 +29,7 @@
 #include <mt/time.h>
 #include <dmem/char.h>
 #include <stdio.h>
+#include <string.h>
 
 #if defined _WIN32 && !defined NDEBUG
 #   include <crtdbg.h>
@@ -36,8 +37,10 @@
 
 #ifdef _WIN32
 #   include <windows.h>
+#   include <malloc.h>
 #else
 #   include <pthread.h>
+#   include <unistd.h>
 #endif
 
 /* ------------------------------------------------------------------------- */
@@ -78,3 +81,49 @@ void MT_Log(const char* format, ...)
     dv_free(str);
 }
 
+/* ------------------------------------------------------------------------- */
+
+int MTI_CpuCount(void)
+{
+#if defined _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#elif defined _SC_NPROCESSORS_ONLN
+    long num = sysconf(_SC_NPROCESSORS_ONLN);
+    return num > 0 ? (int) num : 1;
+#else
+    return 1;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
+void* MTI_AlignedAlloc(size_t size)
+{
+    void* p;
+
+#ifdef _WIN32
+    p = _aligned_malloc(size, MT_CACHE_LINE_SIZE);
+#else
+    if (posix_memalign(&p, MT_CACHE_LINE_SIZE, size)) {
+        p = NULL;
+    }
+#endif
+
+    if (p) {
+        memset(p, 0, size);
+    }
+
+    return p;
+}
+
+void MTI_AlignedFree(void* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
@@ -38,6 +38,8 @@
 #	pragma warning(disable:4127) /* conditional expression is constant */
 #endif
 
+#include <stddef.h>
+
 void MT_Log(const char* format, ...);
 
 #define MT_LOG_ENABLED 1
@@ -46,3 +48,59 @@ void MT_Log(const char* format, ...);
 
 typedef struct MTI_EventQueue MTI_EventQueue;
 
+/* Hint to pull a cache line in that we will be reading shortly */
+#if defined __GNUC__
+#define MTI_PREFETCH(p) __builtin_prefetch(p)
+#elif defined _MSC_VER && (defined _M_IX86 || defined _M_X64)
+#include <xmmintrin.h>
+#define MTI_PREFETCH(p) _mm_prefetch((const char*) (p), _MM_HINT_T0)
+#else
+#define MTI_PREFETCH(p) ((void) 0)
+#endif
+
+/* Hint to the CPU that we are in a busy wait loop */
+#if defined __GNUC__ && (defined __i386__ || defined __x86_64__)
+#define MTI_CPU_RELAX() __builtin_ia32_pause()
+#elif defined __GNUC__ && defined __aarch64__
+#define MTI_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#elif defined _MSC_VER && (defined _M_IX86 || defined _M_X64)
+#define MTI_CPU_RELAX() _mm_pause()
+#else
+#define MTI_CPU_RELAX() ((void) 0)
+#endif
+
+/* Compiler thread locals for the library's own per thread state, which is
+ * read on every send and emit. Users keep using MT_ThreadStorage. Where
+ * the compiler has no thread local support MTI_THREAD_LOCAL is undefined
+ * and the MTI_*_THREAD_LOCAL macros fall back to MT_ThreadStorage, so the
+ * files using them also need <mt/thread.h>.
+ */
+#if defined MT_NO_THREADS
+#define MTI_THREAD_LOCAL
+#elif defined _MSC_VER
+#define MTI_THREAD_LOCAL __declspec(thread)
+#elif defined __GNUC__
+#define MTI_THREAD_LOCAL __thread
+#elif defined __STDC_VERSION__ && __STDC_VERSION__ >= 201112L && !defined __STDC_NO_THREADS__
+#define MTI_THREAD_LOCAL _Thread_local
+#endif
+
+#ifdef MTI_THREAD_LOCAL
+#define MTI_DECLARE_THREAD_LOCAL(type, name)    static MTI_THREAD_LOCAL type name
+#define MTI_GET_THREAD_LOCAL(type, name)        (name)
+#define MTI_SET_THREAD_LOCAL(name, val)         ((void) ((name) = (val)))
+#else
+#define MTI_DECLARE_THREAD_LOCAL(type, name)    static MT_ThreadStorage name = MT_THREAD_STORAGE_INITIALIZER
+#define MTI_GET_THREAD_LOCAL(type, name)        ((type) MT_GetThreadStorage(&name))
+#define MTI_SET_THREAD_LOCAL(name, val)         MT_SetThreadStorage(&name, (void*) (val))
+#endif
+
+/* Number of online CPUs, used to size the default number of threads */
+int MTI_CpuCount(void);
+
+/* Returns zeroed memory aligned to MT_CACHE_LINE_SIZE. It must be freed with
+ * MTI_AlignedFree.
+ */
+void* MTI_AlignedAlloc(size_t size);
+void MTI_AlignedFree(void* p);
+
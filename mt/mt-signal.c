@@ -26,6 +26,10 @@
  */
 
 #include "mt-signal.h"
+#include <mt/thread.h>
+#include <mt/lock.h>
+#include <mt/atomic.h>
+#include <string.h>
 
 /* ------------------------------------------------------------------------- */
 
@@ -42,9 +46,244 @@ void MTI_FreeDelegateVector(MTI_DelegateVector* vec)
 
 /* ------------------------------------------------------------------------- */
 
+/* Starts at 1 so that 0 can mean quiescent in the records */
+static volatile long g_epoch = 1;
+
+MTI_DECLARE_THREAD_LOCAL(MTI_EpochRecord*, g_epoch_record);
+
+/* Protects the record list and the retired list */
+static MT_Mutex g_epoch_lock = MT_MUTEX_INITIALIZER;
+static MTI_EpochRecord* g_epoch_records;
+static MTI_DelegateVector* g_retired;
+
+static MTI_EpochRecord* AcquireEpochRecord(void)
+{
+    MTI_EpochRecord* r;
+
+    MT_Lock(&g_epoch_lock);
+
+    for (r = g_epoch_records; r != NULL; r = r->next) {
+        if (MT_AtomicSetFrom(&r->in_use, 0, 1) == 0) {
+            break;
+        }
+    }
+
+    if (!r) {
+        r = (MTI_EpochRecord*) MTI_AlignedAlloc(sizeof(MTI_EpochRecord));
+        r->in_use = 1;
+        r->next = g_epoch_records;
+        g_epoch_records = r;
+    }
+
+    MT_Unlock(&g_epoch_lock);
+
+    MTI_SET_THREAD_LOCAL(g_epoch_record, r);
+    return r;
+}
+
+void MTI_ReleaseSignalEpoch(void)
+{
+    MTI_EpochRecord* r = MTI_GET_THREAD_LOCAL(MTI_EpochRecord*, g_epoch_record);
+
+    if (r) {
+        MTI_SET_THREAD_LOCAL(g_epoch_record, NULL);
+        MT_AtomicSet(&r->in_use, 0);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+MTI_EpochRecord* MTI_EnterSignalEpoch(void)
+{
+    MTI_EpochRecord* r = MTI_GET_THREAD_LOCAL(MTI_EpochRecord*, g_epoch_record);
+
+    if (!r) {
+        r = AcquireEpochRecord();
+    }
+
+    if (r->depth++ == 0) {
+        /* The epoch has to be visible to the reclaimer before we read any
+         * target list.
+         */
+        r->epoch = g_epoch;
+        MT_MemoryBarrier();
+    }
+
+    return r;
+}
+
+void MTI_ExitSignalEpoch(MTI_EpochRecord* r)
+{
+    if (--r->depth == 0) {
+        /* Our reads of the target list must complete before we are seen as
+         * quiescent.
+         */
+        MT_MemoryBarrier();
+        r->epoch = 0;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Advances the global epoch whilst every thread in an emit has seen the
+ * current one and returns the vectors that can no longer be reached. Two
+ * advances are enough to free everything when no emit is in progress.
+ * Anything left over is picked up by a later call. Must be called with
+ * g_epoch_lock held.
+ */
+static MTI_DelegateVector* CollectRetired(void)
+{
+    MTI_DelegateVector* free_list = NULL;
+    MTI_DelegateVector** pvec;
+    long epoch = g_epoch;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        MTI_EpochRecord* r;
+
+        MT_MemoryBarrier();
+
+        for (r = g_epoch_records; r != NULL; r = r->next) {
+            long e = r->epoch;
+            if (e != 0 && e != epoch) {
+                break;
+            }
+        }
+
+        if (r != NULL) {
+            break;
+        }
+
+        g_epoch = ++epoch;
+    }
+
+    pvec = &g_retired;
+    while (*pvec) {
+        MTI_DelegateVector* vec = *pvec;
+
+        if (vec->retired_epoch + 2 <= epoch) {
+            *pvec = vec->next_retired;
+            vec->next_retired = free_list;
+            free_list = vec;
+        } else {
+            pvec = &vec->next_retired;
+        }
+    }
+
+    return free_list;
+}
+
+void MTI_RetireDelegateVector(MTI_DelegateVector* vec)
+{
+    MTI_DelegateVector* free_list;
+
+    MT_Lock(&g_epoch_lock);
+
+    if (vec) {
+        /* The caller has already unlinked vec, so only emits that started
+         * in this epoch or earlier can still see it.
+         */
+        MT_MemoryBarrier();
+        vec->retired_epoch = g_epoch;
+        vec->next_retired = g_retired;
+        g_retired = vec;
+    }
+
+    free_list = CollectRetired();
+
+    MT_Unlock(&g_epoch_lock);
+
+    /* Free outside of the lock as freeing the weak data may run arbitrary
+     * code.
+     */
+    while (free_list) {
+        MTI_DelegateVector* next = free_list->next_retired;
+        MT_Deref(free_list, MTI_FreeDelegateVector(free_list));
+        free_list = next;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
 void MT_BaseDestroySignal(MTI_DelegateVector* targets)
 {
-    MT_Deref(targets, MTI_FreeDelegateVector(targets));
+    MTI_RetireDelegateVector(targets);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool SameGroup(MTI_SignalReg* a, MTI_SignalReg* b)
+{
+    return a->type == b->type && a->weak_data->message_queue == b->weak_data->message_queue;
+}
+
+/* Recalculates the group_size fields after the registrations have changed */
+static void GroupTargets(MTI_DelegateVector* vec)
+{
+    int i, first = 0;
+
+    for (i = 0; i < vec->size; i++) {
+        vec->regs[i].group_size = 0;
+
+        if (!SameGroup(&vec->regs[first], &vec->regs[i])) {
+            first = i;
+        }
+
+        vec->regs[first].group_size++;
+    }
+}
+
+/* Copies the registrations of cur_vec that are still alive and for which
+ * the skip test fails into a new vector with room for extra more. The old
+ * vector keeps its own weak data refs as emitters may still be reading it.
+ */
+static MTI_DelegateVector* CopyTargets(MTI_DelegateVector* cur_vec, int extra, MT_MessageCallback func, void* obj)
+{
+    MTI_DelegateVector* new_vec;
+    int cur_size = cur_vec ? cur_vec->size : 0;
+    int i;
+
+    /* -1 due to new_vec->regs being a [1] array */
+    size_t alloc = sizeof(MTI_DelegateVector);
+    if (cur_size + extra > 1) {
+        alloc += (cur_size + extra - 1) * sizeof(MTI_SignalReg);
+    }
+
+    new_vec = (MTI_DelegateVector*) malloc(alloc);
+    new_vec->ref = 1;
+    new_vec->next_retired = NULL;
+    new_vec->retired_epoch = 0;
+    new_vec->size = 0;
+
+    for (i = 0; i < cur_size; i++) {
+        MTI_SignalReg* cur_reg = &cur_vec->regs[i];
+
+        if (cur_reg->weak_data->object == NULL) {
+            /* Drop dead targets */
+        } else if (func && cur_reg->dlg.func == func && cur_reg->dlg.obj == obj) {
+            /* Drop disconnected targets */
+        } else {
+            MTI_SignalReg* new_reg = &new_vec->regs[new_vec->size++];
+            *new_reg = *cur_reg;
+            MT_Ref(new_reg->weak_data);
+        }
+    }
+
+    return new_vec;
+}
+
+/* Publishes new_vec as the target list and retires the old one. Must be
+ * called with the signal lock held.
+ */
+static void SwapTargets(MT_Signal(void)* sig, MTI_DelegateVector* new_vec)
+{
+    MTI_DelegateVector* cur_vec = sig->targets;
+
+    /* The vector must be fully written before emitters can see it */
+    MT_MemoryBarrier();
+    sig->targets = new_vec;
+
+    MTI_RetireDelegateVector(cur_vec);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -52,48 +291,40 @@ void MT_BaseDestroySignal(MTI_DelegateVector* targets)
 static void Connect(void* psig, MT_Delegate_void dlg, MT_WeakData* weak_data, MT_SendType type)
 {
     MT_Signal(void)* sig = (MT_Signal(void)*) psig;
-    size_t alloc = sizeof(MTI_DelegateVector);
     MTI_DelegateVector* new_vec;
-    MTI_DelegateVector* cur_vec = sig->targets;
+    MTI_SignalReg reg;
+    int i;
 
     MT_Lock(&sig->lock);
 
-    if (cur_vec) {
-        int i;
-
-        alloc += cur_vec->size * sizeof(MTI_SignalReg);
-        new_vec = (MTI_DelegateVector*) malloc(alloc);
-        new_vec->ref = 1;
-        new_vec->size = 0;
+    new_vec = CopyTargets(sig->targets, 1, NULL, NULL);
 
-        for (i = 0; i < cur_vec->size; i++) {
-            MTI_SignalReg* cur_reg = &cur_vec->regs[i];
-            MTI_SignalReg* new_reg = &new_vec->regs[new_vec->size];
+    reg.dlg = dlg;
+    reg.weak_data = weak_data;
+    reg.type = type;
+    reg.group_size = 0;
 
-            if (cur_reg->weak_data->object == NULL) {
-                MT_DerefWeakData(cur_reg->weak_data);
-            } else {
-                *new_reg = *cur_reg;
-                MT_Ref(new_reg->weak_data);
-                new_vec->size++;
-            }
+    /* Insert after the last registration in the same group to keep groups
+     * contiguous, otherwise at the end.
+     */
+    for (i = new_vec->size; i > 0; i--) {
+        if (SameGroup(&new_vec->regs[i - 1], &reg)) {
+            break;
         }
+    }
 
-    } else {
-        new_vec = (MTI_DelegateVector*) malloc(alloc);
-        new_vec->ref = 1;
-        new_vec->size = 0;
+    if (i == 0) {
+        i = new_vec->size;
     }
 
-    new_vec->regs[new_vec->size].dlg = dlg;
-    new_vec->regs[new_vec->size].weak_data = weak_data;
-    new_vec->regs[new_vec->size].type = type;
+    memmove(&new_vec->regs[i + 1], &new_vec->regs[i], (new_vec->size - i) * sizeof(MTI_SignalReg));
+    new_vec->regs[i] = reg;
     new_vec->size++;
 
     MT_Ref(weak_data);
 
-    sig->targets = new_vec;
-    MT_Deref(cur_vec, MTI_FreeDelegateVector(cur_vec));
+    GroupTargets(new_vec);
+    SwapTargets(sig, new_vec);
 
     MT_Unlock(&sig->lock);
 }
@@ -120,39 +351,16 @@ void MT_BaseDisconnect2(void* psig, MT_MessageCallback func, void* obj)
     MT_Lock(&sig->lock);
 
     if (sig->targets) {
-        int i;
-        MTI_DelegateVector *new_vec, *cur_vec;
-        size_t alloc = sizeof(MTI_DelegateVector);
-
-        cur_vec = sig->targets;
-        new_vec = (MTI_DelegateVector*) malloc(alloc);
-
-        /* -1 due to new_vec->regs being a [1] array */
-        alloc += (cur_vec->size - 1) * sizeof(MTI_SignalReg);
-
-        new_vec->ref = 1;
-        new_vec->size = 0;
-
-        for (i = 0; i < cur_vec->size; i++) {
-            MTI_SignalReg* cur_reg = &cur_vec->regs[i];
-            MTI_SignalReg* new_reg = &new_vec->regs[new_vec->size];
-
-            if (cur_reg->weak_data->object == NULL || (cur_reg->dlg.func == func && cur_reg->dlg.obj == obj)) {
-                MT_DerefWeakData(cur_reg->weak_data);
-            } else {
-                *new_reg = *cur_reg;
-                MT_Ref(new_reg->weak_data);
-                new_vec->size++;
-            }
-        }
+        MTI_DelegateVector* new_vec = CopyTargets(sig->targets, 0, func, obj);
 
         if (new_vec->size == 0) {
-            MT_Deref(new_vec, MTI_FreeDelegateVector(new_vec));
+            MTI_FreeDelegateVector(new_vec);
             new_vec = NULL;
+        } else {
+            GroupTargets(new_vec);
         }
 
-        sig->targets = new_vec;
-        MT_Deref(cur_vec, MTI_FreeDelegateVector(cur_vec));
+        SwapTargets(sig, new_vec);
     }
 
     MT_Unlock(&sig->lock);
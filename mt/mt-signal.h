@@ -36,14 +36,73 @@ struct MTI_SignalReg {
     MT_Delegate_void    dlg;
     MT_WeakData*        weak_data;
     MT_SendType         type;
+
+    /* Registrations with the same message queue and send type are kept
+     * next to each other. This is the length of the run for the first
+     * registration in a run and 0 for the rest.
+     */
+    int                 group_size;
 };
 
+/* Target lists are copy on write. Emitters read sig->targets without taking
+ * the signal lock or a reference. Connect and disconnect swap in a new
+ * vector under the lock and retire the old one, which is freed once every
+ * thread that could still be reading it has left its emit.
+ */
 struct MTI_DelegateVector {
+    /* The signal holds one ref until the vector has been retired. Messages
+     * proxying an emit to a group of targets hold another so that they can
+     * use the registrations in regs.
+     */
     MT_AtomicInt        ref;
+
+    /* Link and epoch used whilst the vector is waiting to be freed */
+    MTI_DelegateVector* next_retired;
+    long                retired_epoch;
+
     int                 size;
     MTI_SignalReg       regs[1];
 };
 
-
 void MTI_FreeDelegateVector(MTI_DelegateVector* vec);
 
+/* ------------------------------------------------------------------------- */
+
+/* Epoch based reclamation for the target lists.
+ *
+ * Each thread that emits gets an epoch record. Emit copies the global epoch
+ * into the thread's record on entry and clears it on exit, so the only
+ * shared cache line an emit touches is the read-mostly global epoch. The
+ * global epoch can only advance once every active record has seen the
+ * current value, so a vector retired in epoch E is unreachable by the time
+ * the global epoch reaches E + 2.
+ *
+ * Emits may nest (a direct target emitting another signal). Only the
+ * outermost emit publishes the epoch.
+ */
+
+typedef struct MTI_EpochRecord MTI_EpochRecord;
+
+struct MTI_EpochRecord {
+    /* Global epoch seen on entry or 0 when the thread is not in an emit */
+    volatile long       epoch;
+    int                 depth;
+
+    /* Set whilst a thread owns the record. Records are never freed, they
+     * are released when the thread exits and picked up by new threads.
+     */
+    MT_AtomicInt        in_use;
+    MTI_EpochRecord*    next;
+
+    char                pad[MT_CACHE_LINE_SIZE - sizeof(long) - sizeof(int) - sizeof(MT_AtomicInt) - sizeof(MTI_EpochRecord*)];
+};
+
+MTI_EpochRecord* MTI_EnterSignalEpoch(void);
+void MTI_ExitSignalEpoch(MTI_EpochRecord* r);
+
+/* Hands a vector that has been unlinked from its signal to the reclaimer */
+void MTI_RetireDelegateVector(MTI_DelegateVector* vec);
+
+/* Called by a thread before it exits to release its epoch record */
+void MTI_ReleaseSignalEpoch(void);
+
@@ -104,7 +104,7 @@ MT_WeakData* MT_GetWeakData(const MT_Object* sc)
 
 bool MT_IsSynchronous(MT_WeakData* s)
 {
-    return s->message_queue == MT_CurrentMessageQueue();
+    return s->message_queue == MTI_CurrentMessageQueue();
 }
 
 
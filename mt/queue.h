@@ -38,13 +38,17 @@ struct MTI_AtomicQueueItem {
     MTI_AtomicQueueItem* volatile   next;
 };
 
-/* Pad out the pointers to prevent false cache sharing */
+/* first is only used by the consumer and last mostly by the producers. Each
+ * is padded out to a full cache line to prevent false cache sharing, so the
+ * queue should be allocated on a cache line boundary (see
+ * MTI_AlignedAlloc).
+ */
 struct MTI_AtomicQueue {
     MTI_AtomicQueueItem* volatile   first;
-    char                            first_pad[16 - sizeof(MTI_AtomicQueueItem*)];
+    char                            first_pad[MT_CACHE_LINE_SIZE - sizeof(MTI_AtomicQueueItem*)];
 
     MTI_AtomicQueueItem* volatile   last;
-    char                            last_pad[16 - sizeof(MTI_AtomicQueueItem*)];
+    char                            last_pad[MT_CACHE_LINE_SIZE - sizeof(MTI_AtomicQueueItem*)];
 };
 
 /* ------------------------------------------------------------------------- */
@@ -92,21 +96,32 @@ static MTI_AtomicQueueItem* MTI_AtomicQueue_Consume(MTI_AtomicQueue* s)
 
 /* ------------------------------------------------------------------------- */
 
-/* This can be called from any producer thread as long as you synchronise
- * destroying the queue.
+/* Appends a chain of items that have already been linked together through
+ * their next pointers with a single exchange. This can be called from any
+ * producer thread as long as you synchronise destroying the queue.
  */
-static void MTI_AtomicQueue_Produce(MTI_AtomicQueue* s, MTI_AtomicQueueItem* newval)
+static void MTI_AtomicQueue_ProduceChain(MTI_AtomicQueue* s, MTI_AtomicQueueItem* first, MTI_AtomicQueueItem* last)
 {
     MTI_AtomicQueueItem* prevlast;
-    newval->next = NULL;
+    last->next = NULL;
 
-    /* Append a new item to the list */
-    prevlast = MT_AtomicSetPtr(&s->last, newval);
+    /* Append the new items to the list */
+    prevlast = MT_AtomicSetPtr(&s->last, last);
 
-    /* Release the item to the consumer */
+    /* Release the items to the consumer */
     if (prevlast) {
-        (void) MT_AtomicSetPtr(&prevlast->next, newval);
+        (void) MT_AtomicSetPtr(&prevlast->next, first);
     } else {
-        (void) MT_AtomicSetPtr(&s->first, newval);
+        (void) MT_AtomicSetPtr(&s->first, first);
     }
 }
+
+/* ------------------------------------------------------------------------- */
+
+/* This can be called from any producer thread as long as you synchronise
+ * destroying the queue.
+ */
+static void MTI_AtomicQueue_Produce(MTI_AtomicQueue* s, MTI_AtomicQueueItem* newval)
+{
+    MTI_AtomicQueue_ProduceChain(s, newval, newval);
+}
@@ -0,0 +1,271 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * This software is licensed under the stock MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+
+#include "mt-internal.h"
+#include <mt/server.h>
+#include <mt/socket.h>
+#include <mt/event.h>
+#include <mt/thread.h>
+#include <dmem/vector.h>
+
+/* Maximum number of connections accepted per listening socket each time it
+ * is signalled before going back to the event loop.
+ */
+#define MTI_ACCEPT_BATCH 64
+
+DVECTOR_INIT(ServerEvent, MT_Event*);
+
+typedef struct MTI_ServerLoop MTI_ServerLoop;
+
+struct MTI_ServerLoop {
+    MT_Thread*              thread;
+    d_Vector(MT_Socket)     sockets;
+    d_Vector(ServerEvent)   events;
+    MT_AcceptDelegate       on_accept;
+};
+
+struct MT_Server {
+    int                     loop_num;
+    MTI_ServerLoop*         loops;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void OnAccept(MTI_ServerLoop* l)
+{
+    int i, j;
+
+    for (i = 0; i < l->sockets.size; i++) {
+        for (j = 0; j < MTI_ACCEPT_BATCH; j++) {
+            MT_Socket sock = MT_AcceptTCP(l->sockets.data[i], NULL);
+
+            if (sock == MT_SOCKET_INVALID) {
+                break;
+            }
+
+            if (l->on_accept.func) {
+                CALL_DELEGATE_1(l->on_accept, sock);
+            } else {
+                closesocket(sock);
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void CloseListeners(MTI_ServerLoop* l)
+{
+    int i;
+
+    for (i = 0; i < l->events.size; i++) {
+        MT_FreeEvent(l->events.data[i]);
+    }
+
+    for (i = 0; i < l->sockets.size; i++) {
+        closesocket(l->sockets.data[i]);
+    }
+
+    dv_clear(&l->events);
+    dv_clear(&l->sockets);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Binds the listening sockets for a loop. This is called between
+ * MT_BeginThreadInit and MT_StartThread so the events are registered with
+ * the loop's event queue. With a port of 0 the later loops bind each of the
+ * addresses the first loop was given, as the ephemeral port can differ
+ * between address families.
+ */
+static bool BindLoop(MT_Server* s, MTI_ServerLoop* l, d_Slice(char) url, int flags)
+{
+    MTI_ServerLoop* first = &s->loops[0];
+    int i;
+
+    if (l != first && dv_ends_with(url, C(":0"))) {
+        d_Vector(char) bound = DV_INIT;
+
+        for (i = 0; i < first->sockets.size; i++) {
+            dv_clear(&bound);
+            MT_SocketUrl(&bound, first->sockets.data[i], 0);
+            MT_BindTCP(bound, &l->sockets, flags);
+        }
+
+        dv_free(bound);
+
+        if (l->sockets.size != first->sockets.size) {
+            return false;
+        }
+
+    } else {
+        MT_BindTCP(url, &l->sockets, flags);
+    }
+
+    for (i = 0; i < l->sockets.size; i++) {
+        MT_Event* e = MT_NewServerSocketEvent(l->sockets.data[i], BindVoid(&OnAccept, l));
+
+        if (e == NULL) {
+            return false;
+        }
+
+        dv_append1(&l->events, e);
+    }
+
+    return l->sockets.size > 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Tells the accept handler that no more sockets are coming so that it can
+ * free itself. This is called on the loop thread or whilst initialising it.
+ */
+static void StopAccept(MTI_ServerLoop* l)
+{
+    if (l->on_accept.func) {
+        CALL_DELEGATE_1(l->on_accept, MT_SOCKET_INVALID);
+        l->on_accept.func = NULL;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int RunLoop(MTI_ServerLoop* l)
+{
+    MT_RunEventLoop();
+    CloseListeners(l);
+    StopAccept(l);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+MT_Server* MT_NewServer(d_Slice(char) url, int loops, MT_ServerInit init)
+{
+    MT_Server* s;
+    int flags = MT_SOCKET_REUSEADDR | MT_SOCKET_LISTEN;
+    int i;
+
+#ifdef SO_REUSEPORT
+    flags |= MT_SOCKET_REUSEPORT;
+
+    if (loops <= 0) {
+        loops = MTI_CpuCount();
+    }
+#else
+    loops = 1;
+#endif
+
+    s = NEW(MT_Server);
+    s->loop_num = loops;
+    s->loops = (MTI_ServerLoop*) calloc(loops, sizeof(MTI_ServerLoop));
+
+    for (i = 0; i < loops; i++) {
+        MTI_ServerLoop* l = &s->loops[i];
+        bool ok;
+
+        l->thread = MT_NewThread("server %d", i);
+
+        MT_BeginThreadInit(l->thread);
+
+        ok = BindLoop(s, l, url, flags);
+
+        if (ok && init.func) {
+            l->on_accept = CALL_DELEGATE_1(init, i);
+        }
+
+        MT_EndThreadInit(l->thread);
+
+        if (!ok) {
+            int j;
+            MT_LOG("Server bind failed on loop %d", i);
+
+            /* None of the loops have started so we still own the listeners
+             * and the accept handlers.
+             */
+            for (j = 0; j <= i; j++) {
+                MTI_ServerLoop* fl = &s->loops[j];
+                MT_BeginThreadInit(fl->thread);
+                CloseListeners(fl);
+                StopAccept(fl);
+                MT_EndThreadInit(fl->thread);
+            }
+
+            s->loop_num = i + 1;
+            MT_FreeServer(s);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < loops; i++) {
+        MTI_ServerLoop* l = &s->loops[i];
+        MT_StartThread(l->thread, BindInt(&RunLoop, l));
+    }
+
+    return s;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void MT_FreeServer(MT_Server* s)
+{
+    if (s) {
+        int i;
+
+        for (i = 0; i < s->loop_num; i++) {
+            MT_ExitThread(s->loops[i].thread);
+        }
+
+        for (i = 0; i < s->loop_num; i++) {
+            MTI_ServerLoop* l = &s->loops[i];
+
+            /* The loop closes its listeners before the thread exits */
+            MT_FreeThread(l->thread);
+            dv_free(l->events);
+            dv_free(l->sockets);
+        }
+
+        free(s->loops);
+        free(s);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+int MT_ServerLoopCount(MT_Server* s)
+{ return s->loop_num; }
+
+MT_Thread* MT_ServerThread(MT_Server* s, int loop)
+{ return s->loops[loop].thread; }
+
+MT_Socket MT_ServerSocket(MT_Server* s, int loop)
+{
+    MTI_ServerLoop* l = &s->loops[loop];
+    return l->sockets.size ? l->sockets.data[0] : MT_SOCKET_INVALID;
+}
+
@@ -221,6 +221,19 @@ static void Bind(
             continue;
         }
 
+        if (flags & MT_SOCKET_REUSEPORT) {
+#ifdef SO_REUSEPORT
+            int reuseport = 1;
+            if (setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (char*) &reuseport, sizeof(reuseport))) {
+                closesocket(sfd);
+                continue;
+            }
+#else
+            closesocket(sfd);
+            continue;
+#endif
+        }
+
         if (bind(sfd, rp->ai_addr, (int) rp->ai_addrlen)) {
             closesocket(sfd);
             continue;
@@ -0,0 +1,555 @@
+/* vim: ts=4 sw=4 sts=4 et
+ *
+ * Copyright (c) 2009 James R. McKaskill
+ *
+ * This software is licensed under the stock MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+
+#ifdef _WIN32
+#include <windows.h>
+#include <limits.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "mt-internal.h"
+#include "queue.h"
+#include <mt/thread-pool.h>
+#include <mt/thread.h>
+#include <mt/atomic.h>
+
+/* Initial number of slots in each worker's deque. The deque doubles in size
+ * whenever it fills up.
+ */
+#define MTI_DEQUE_SIZE 256
+
+/* Maximum number of jobs moved from the inbox to a worker's deque in one go */
+#define MTI_INBOX_BATCH 32
+
+typedef struct MTI_Job MTI_Job;
+typedef struct MTI_JobArray MTI_JobArray;
+typedef struct MTI_JobDeque MTI_JobDeque;
+typedef struct MTI_PoolWorker MTI_PoolWorker;
+
+struct MTI_Job {
+    MTI_AtomicQueueItem     qitem;
+    VoidDelegate            work;
+    MT_Pipe(void)           done;
+    const void*             argument;
+};
+
+struct MTI_JobArray {
+    long                    mask;
+
+    /* Arrays that have been replaced by a bigger one are kept until the pool
+     * is freed as thieves may still be reading from them.
+     */
+    MTI_JobArray*           prev;
+
+    MTI_Job* volatile       jobs[1];
+};
+
+/* Chase-Lev work stealing deque. The owning worker pushes and pops jobs at
+ * the bottom and other workers steal them from the top.
+ */
+struct MTI_JobDeque {
+    MT_AtomicInt            top;
+    char                    top_pad[MT_CACHE_LINE_SIZE - sizeof(MT_AtomicInt)];
+
+    MT_AtomicInt            bottom;
+    MTI_JobArray* volatile  array;
+    char                    bottom_pad[MT_CACHE_LINE_SIZE - sizeof(MT_AtomicInt) - sizeof(MTI_JobArray*)];
+};
+
+/* Workers are allocated on a cache line boundary and the deque is padded out
+ * so that a worker's bottom doesn't share a line with its neighbour's top.
+ */
+struct MTI_PoolWorker {
+    MTI_JobDeque            deque;
+    MT_ThreadPool*          pool;
+    MT_Thread*              thread;
+    unsigned int            seed;
+    char                    pad[MT_CACHE_LINE_SIZE - sizeof(MT_ThreadPool*) - sizeof(MT_Thread*) - sizeof(unsigned int)];
+};
+
+struct MT_ThreadPool {
+    /* Jobs submitted from outside the pool. Any worker can drain it but only
+     * one at a time, which is arbitrated by inbox_lock.
+     */
+    MTI_AtomicQueue         inbox;
+    MT_AtomicInt            inbox_lock;
+
+    /* Number of workers that are about to wait or are waiting for work */
+    MT_AtomicInt            sleeping;
+    char                    sleeping_pad[MT_CACHE_LINE_SIZE - 2 * sizeof(MT_AtomicInt)];
+
+    MT_AtomicInt            exit;
+
+    int                     worker_num;
+    MTI_PoolWorker*         workers;
+
+#ifdef _WIN32
+    MT_Handle               semaphore;
+#else
+    pthread_mutex_t         lock;
+    pthread_cond_t          wakeup;
+    int                     signals;
+#endif
+};
+
+MTI_DECLARE_THREAD_LOCAL(MTI_PoolWorker*, g_current_worker);
+
+/* ------------------------------------------------------------------------- */
+
+static MTI_JobArray* NewJobArray(long size)
+{
+    MTI_JobArray* a = (MTI_JobArray*) malloc(sizeof(MTI_JobArray) + (size - 1) * sizeof(MTI_Job*));
+    a->mask = size - 1;
+    a->prev = NULL;
+    return a;
+}
+
+static void InitDeque(MTI_JobDeque* d)
+{
+    d->top = 0;
+    d->bottom = 0;
+    d->array = NewJobArray(MTI_DEQUE_SIZE);
+}
+
+static void DestroyDeque(MTI_JobDeque* d)
+{
+    MTI_JobArray* a = d->array;
+
+    while (a) {
+        MTI_JobArray* prev = a->prev;
+        free(a);
+        a = prev;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static MTI_JobArray* GrowDeque(MTI_JobDeque* d, MTI_JobArray* a, long top, long bottom)
+{
+    MTI_JobArray* n = NewJobArray((a->mask + 1) * 2);
+    long i;
+
+    for (i = top; i < bottom; i++) {
+        n->jobs[i & n->mask] = a->jobs[i & a->mask];
+    }
+
+    n->prev = a;
+
+    /* Publish the copied jobs before the new array */
+    MT_MemoryBarrier();
+    d->array = n;
+    return n;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Only called by the owning worker */
+static void PushJob(MTI_JobDeque* d, MTI_Job* job)
+{
+    long bottom = d->bottom;
+    long top = d->top;
+    MTI_JobArray* a = d->array;
+
+    if (bottom - top > a->mask) {
+        a = GrowDeque(d, a, top, bottom);
+    }
+
+    a->jobs[bottom & a->mask] = job;
+
+    /* Publish the job before the new bottom */
+    MT_MemoryBarrier();
+    d->bottom = bottom + 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Only called by the owning worker */
+static MTI_Job* PopJob(MTI_JobDeque* d)
+{
+    long bottom = d->bottom - 1;
+    MTI_JobArray* a = d->array;
+    MTI_Job* job;
+    long top;
+
+    d->bottom = bottom;
+
+    /* The store to bottom must be visible before we read top so that we and
+     * a thief can't both take the last job.
+     */
+    MT_MemoryBarrier();
+    top = d->top;
+
+    if (top > bottom) {
+        /* Empty */
+        d->bottom = bottom + 1;
+        return NULL;
+    }
+
+    job = a->jobs[bottom & a->mask];
+
+    if (top == bottom) {
+        /* Last job so race the thieves for it */
+        if (MT_AtomicSetFrom(&d->top, top, top + 1) != top) {
+            job = NULL;
+        }
+
+        d->bottom = bottom + 1;
+    }
+
+    return job;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Can be called from any worker. Returns NULL if the deque is empty or we
+ * lost a race for the top job.
+ */
+static MTI_Job* StealJob(MTI_JobDeque* d)
+{
+    long top = d->top;
+    long bottom;
+    MTI_JobArray* a;
+    MTI_Job* job;
+
+    MT_MemoryBarrier();
+    bottom = d->bottom;
+
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    a = d->array;
+    job = a->jobs[top & a->mask];
+
+    if (MT_AtomicSetFrom(&d->top, top, top + 1) != top) {
+        return NULL;
+    }
+
+    return job;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void PostSignals(MT_ThreadPool* s, int num)
+{
+#ifdef _WIN32
+    ReleaseSemaphore(s->semaphore, num, NULL);
+#else
+    pthread_mutex_lock(&s->lock);
+
+    /* Any more than one per worker would just cause spurious wakeups */
+    s->signals += num;
+    if (s->signals > s->worker_num) {
+        s->signals = s->worker_num;
+    }
+
+    if (num > 1) {
+        pthread_cond_broadcast(&s->wakeup);
+    } else {
+        pthread_cond_signal(&s->wakeup);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+#endif
+}
+
+static void WaitForSignal(MT_ThreadPool* s)
+{
+#ifdef _WIN32
+    WaitForSingleObject(s->semaphore, INFINITE);
+#else
+    pthread_mutex_lock(&s->lock);
+
+    while (s->signals == 0) {
+        pthread_cond_wait(&s->wakeup, &s->lock);
+    }
+
+    s->signals--;
+    pthread_mutex_unlock(&s->lock);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Called after making a job available */
+static void WakeWorker(MT_ThreadPool* s)
+{
+    /* Pairs with the increment of sleeping in WaitForWork. Either we see the
+     * sleeping worker or it sees our job.
+     */
+    MT_MemoryBarrier();
+
+    if (s->sleeping > 0) {
+        PostSignals(s, 1);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool HaveWork(MT_ThreadPool* s)
+{
+    int i;
+
+    if (s->inbox.last) {
+        return true;
+    }
+
+    for (i = 0; i < s->worker_num; i++) {
+        MTI_JobDeque* d = &s->workers[i].deque;
+
+        if (d->bottom - d->top > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Moves a batch of jobs from the inbox onto our deque and returns the first
+ * one.
+ */
+static MTI_Job* TakeFromInbox(MTI_PoolWorker* w)
+{
+    MT_ThreadPool* s = w->pool;
+    MTI_Job* first = NULL;
+    int taken;
+
+    if (!s->inbox.last || MT_AtomicSetFrom(&s->inbox_lock, 0, 1) != 0) {
+        return NULL;
+    }
+
+    for (taken = 0; taken < MTI_INBOX_BATCH; taken++) {
+        MTI_AtomicQueueItem* item = MTI_AtomicQueue_Consume(&s->inbox);
+        MTI_Job* job;
+
+        if (!item) {
+            break;
+        }
+
+        job = container_of(item, MTI_Job, qitem);
+
+        if (first) {
+            PushJob(&w->deque, job);
+        } else {
+            first = job;
+        }
+    }
+
+    MT_AtomicSet(&s->inbox_lock, 0);
+
+    if (taken > 1) {
+        /* Let another worker steal the rest */
+        WakeWorker(s);
+    }
+
+    return first;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static MTI_Job* StealFromOthers(MTI_PoolWorker* w)
+{
+    MT_ThreadPool* s = w->pool;
+    int i, start;
+
+    if (s->worker_num < 2) {
+        return NULL;
+    }
+
+    /* Start at a random victim so that the thieves spread out */
+    w->seed = w->seed * 1103515245 + 12345;
+    start = (int) ((w->seed >> 16) % s->worker_num);
+
+    for (i = 0; i < s->worker_num; i++) {
+        MTI_PoolWorker* victim = &s->workers[(start + i) % s->worker_num];
+
+        if (victim != w) {
+            MTI_Job* job = StealJob(&victim->deque);
+
+            if (job) {
+                return job;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void RunJob(MTI_Job* job)
+{
+    CALL_DELEGATE_0(job->work);
+
+    if (job->done.weak_data) {
+        MT_BaseSend(&job->done, job->argument);
+        MT_DerefWeakData(job->done.weak_data);
+    }
+
+    free(job);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void WaitForWork(MT_ThreadPool* s)
+{
+    MT_AtomicIncrement(&s->sleeping);
+
+    if (!s->exit && !HaveWork(s)) {
+        WaitForSignal(s);
+    }
+
+    MT_AtomicDecrement(&s->sleeping);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int WorkerMain(MTI_PoolWorker* w)
+{
+    MT_ThreadPool* s = w->pool;
+
+    MTI_SET_THREAD_LOCAL(g_current_worker, w);
+
+    for (;;) {
+        MTI_Job* job = PopJob(&w->deque);
+
+        if (!job) {
+            job = TakeFromInbox(w);
+        }
+
+        if (!job) {
+            job = StealFromOthers(w);
+        }
+
+        if (job) {
+            RunJob(job);
+        } else if (s->exit && !HaveWork(s)) {
+            break;
+        } else {
+            WaitForWork(s);
+        }
+    }
+
+    MTI_SET_THREAD_LOCAL(g_current_worker, NULL);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+MT_ThreadPool* MT_NewThreadPool(int workers)
+{
+    MT_ThreadPool* s = (MT_ThreadPool*) MTI_AlignedAlloc(sizeof(MT_ThreadPool));
+    int i;
+
+    if (workers <= 0) {
+        workers = MTI_CpuCount();
+    }
+
+#ifdef _WIN32
+    s->semaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+#else
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wakeup, NULL);
+#endif
+
+    s->worker_num = workers;
+    s->workers = (MTI_PoolWorker*) MTI_AlignedAlloc(workers * sizeof(MTI_PoolWorker));
+
+    for (i = 0; i < workers; i++) {
+        MTI_PoolWorker* w = &s->workers[i];
+        InitDeque(&w->deque);
+        w->pool = s;
+        w->seed = (unsigned int) i + 1;
+        w->thread = MT_NewThread("pool %d", i);
+    }
+
+    for (i = 0; i < workers; i++) {
+        MTI_PoolWorker* w = &s->workers[i];
+        MT_StartThread(w->thread, BindInt(&WorkerMain, w));
+    }
+
+    return s;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void MT_FreeThreadPool(MT_ThreadPool* s)
+{
+    if (s) {
+        int i;
+
+        MT_AtomicSet(&s->exit, 1);
+        PostSignals(s, s->worker_num);
+
+        for (i = 0; i < s->worker_num; i++) {
+            MT_FreeThread(s->workers[i].thread);
+        }
+
+        for (i = 0; i < s->worker_num; i++) {
+            DestroyDeque(&s->workers[i].deque);
+        }
+
+#ifdef _WIN32
+        CloseHandle(s->semaphore);
+#else
+        pthread_cond_destroy(&s->wakeup);
+        pthread_mutex_destroy(&s->lock);
+#endif
+
+        MTI_AlignedFree(s->workers);
+        MTI_AlignedFree(s);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+void MT_BaseSubmit(MT_ThreadPool* s, VoidDelegate work, const void* pipe, const void* argument)
+{
+    MTI_PoolWorker* w = MTI_GET_THREAD_LOCAL(MTI_PoolWorker*, g_current_worker);
+    MTI_Job* job = NEW(MTI_Job);
+
+    job->work = work;
+    job->argument = argument;
+
+    if (pipe) {
+        job->done = *(const MT_Pipe(void)*) pipe;
+        MT_RefWeakData(job->done.weak_data);
+    }
+
+    if (w && w->pool == s) {
+        PushJob(&w->deque, job);
+    } else {
+        MTI_AtomicQueue_Produce(&s->inbox, &job->qitem);
+    }
+
+    WakeWorker(s);
+}
+
@@ -28,11 +28,21 @@
 /* To get pthread_mutexattr_settype */
 #define _XOPEN_SOURCE 500
 
+#ifdef __linux__
+/* For pthread_setaffinity_np and the cpu_set_t macros */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
 #include "thread.h"
 #include "message-queue.h"
+#include "mt-signal.h"
 #include <mt/lock.h>
 #include <dmem/vector.h>
 #include <assert.h>
+#include <limits.h>
+#include <stdio.h>
 
 #if defined _WIN32 && !defined _WIN32_WCE
 /* For _beginthreadex */
@@ -41,6 +51,16 @@
 
 #if defined _WIN32
 #include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* From linux/mempolicy.h */
+#define MTI_MPOL_PREFERRED 1
 #endif
 
 static void JoinThread(MT_Thread* s);
@@ -53,6 +73,8 @@ MT_Thread* MT_NewThread2(const char* name, va_list ap)
     MT_InitSignal(int, &s->on_exit);
     dv_vprint(&s->name, name, ap);
     s->message_queue = MT_NewMessageQueue();
+    s->policy = MT_THREAD_INHERIT;
+    s->numa_node = -1;
     return s;
 }
 
@@ -82,17 +104,29 @@ void MT_FreeThread(MT_Thread* s)
         MT_FreeMessageQueue(s->message_queue);
         MT_DestroySignal(&s->on_exit);
         dv_free(s->name);
+        dv_free(s->affinity);
         free(s);
     }
 }
 
 /* ------------------------------------------------------------------------- */
 
+MTI_DECLARE_THREAD_LOCAL(MT_Thread*, g_current_thread);
+
+MT_Thread* MT_CurrentThread(void)
+{
+    return MTI_GET_THREAD_LOCAL(MT_Thread*, g_current_thread);
+}
+
+/* ------------------------------------------------------------------------- */
+
 void MT_BeginThreadInit(MT_Thread* s)
 {
     assert(!s->started);
-    s->old_message_queue = MT_CurrentMessageQueue();
+    s->old_message_queue = MTI_CurrentMessageQueue();
+    s->old_thread = MT_CurrentThread();
     MT_SetCurrentMessageQueue(s->message_queue);
+    MTI_SET_THREAD_LOCAL(g_current_thread, s);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -100,18 +134,48 @@ void MT_BeginThreadInit(MT_Thread* s)
 void MT_EndThreadInit(MT_Thread* s)
 {
     assert(!s->started);
-    assert(MT_CurrentMessageQueue() == s->message_queue);
+    assert(MTI_CurrentMessageQueue() == s->message_queue);
     MT_SetCurrentMessageQueue(s->old_message_queue);
+    MTI_SET_THREAD_LOCAL(g_current_thread, s->old_thread);
     s->old_message_queue = NULL;
+    s->old_thread = NULL;
 }
 
 /* ------------------------------------------------------------------------- */
 
-static MT_ThreadStorage g_thread_name = MT_THREAD_STORAGE_INITIALIZER;
+void MT_SetThreadStackSize(MT_Thread* s, size_t bytes)
+{
+    assert(!s->started);
+    s->stack_size = bytes;
+}
+
+void MT_SetThreadAffinity(MT_Thread* s, const int* cpus, int num)
+{
+    assert(!s->started);
+    dv_clear(&s->affinity);
+    dv_append2(&s->affinity, cpus, num);
+}
+
+void MT_SetThreadScheduling(MT_Thread* s, MT_ThreadPolicy policy, int priority)
+{
+    assert(!s->started);
+    s->policy = policy;
+    s->priority = priority;
+}
+
+void MT_SetThreadNumaNode(MT_Thread* s, int node)
+{
+    assert(!s->started);
+    s->numa_node = node;
+}
+
+/* ------------------------------------------------------------------------- */
+
+MTI_DECLARE_THREAD_LOCAL(const char*, g_thread_name);
 
 const char* MT_GetCurrentThreadName(void)
 {
-    return (const char*) MT_GetThreadStorage(&g_thread_name);
+    return MTI_GET_THREAD_LOCAL(const char*, g_thread_name);
 }
 
 static void SetCurrentThreadName(const char* name)
@@ -138,7 +202,147 @@ static void SetCurrentThreadName(const char* name)
     }
 #endif
 
-    MT_SetThreadStorage(&g_thread_name, (void*) name);
+    MTI_SET_THREAD_LOCAL(g_thread_name, name);
+}
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef __linux__
+/* Appends the CPUs of a NUMA node to cpus. The node's cpulist is of the
+ * form "0-3,8-11".
+ */
+static void NumaNodeCpus(int node, d_Vector(int)* cpus)
+{
+    char path[64];
+    FILE* f;
+    int first, last;
+
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    f = fopen(path, "r");
+
+    if (!f) {
+        return;
+    }
+
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+
+        if (fscanf(f, "-%d", &last) < 0) {
+            last = first;
+        }
+
+        for (; first <= last; first++) {
+            dv_append1(cpus, first);
+        }
+
+        if (fgetc(f) != ',') {
+            break;
+        }
+    }
+
+    fclose(f);
+}
+#endif
+
+/* Applies the thread options to the current thread */
+static void ApplyThreadOptions(MT_Thread* s)
+{
+    d_Vector(int) cpus = DV_INIT;
+    int i;
+
+    dv_append(&cpus, s->affinity);
+
+#if defined __linux__
+    if (s->numa_node >= 0) {
+        unsigned long mask[16];
+        size_t bits = sizeof(mask) * CHAR_BIT;
+
+        if ((size_t) s->numa_node < bits) {
+            memset(mask, 0, sizeof(mask));
+            mask[s->numa_node / (sizeof(long) * CHAR_BIT)] |= 1UL << (s->numa_node % (sizeof(long) * CHAR_BIT));
+
+            if (syscall(SYS_set_mempolicy, MTI_MPOL_PREFERRED, mask, bits + 1)) {
+                MT_LOG("Thread %p failed to set NUMA node %d", s, s->numa_node);
+            }
+        }
+
+        if (cpus.size == 0) {
+            NumaNodeCpus(s->numa_node, &cpus);
+        }
+    }
+
+    if (cpus.size) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for (i = 0; i < cpus.size; i++) {
+            if (cpus.data[i] >= 0 && cpus.data[i] < CPU_SETSIZE) {
+                CPU_SET(cpus.data[i], &set);
+            }
+        }
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            MT_LOG("Thread %p failed to set affinity", s);
+        }
+    }
+
+#elif defined _WIN32
+#ifndef _WIN32_WCE
+    if (s->numa_node >= 0 && cpus.size == 0) {
+        ULONGLONG mask;
+
+        /* Windows allocates from the node of the thread's processor */
+        if (GetNumaNodeProcessorMask((UCHAR) s->numa_node, &mask)) {
+            for (i = 0; i < 64; i++) {
+                if (mask & ((ULONGLONG) 1 << i)) {
+                    dv_append1(&cpus, i);
+                }
+            }
+        }
+    }
+#endif
+
+    if (cpus.size) {
+        DWORD_PTR mask = 0;
+
+        for (i = 0; i < cpus.size; i++) {
+            if (cpus.data[i] >= 0 && cpus.data[i] < (int) (sizeof(DWORD_PTR) * CHAR_BIT)) {
+                mask |= (DWORD_PTR) 1 << cpus.data[i];
+            }
+        }
+
+        if (!SetThreadAffinityMask(GetCurrentThread(), mask)) {
+            MT_LOG("Thread %p failed to set affinity", s);
+        }
+    }
+
+#else
+    if (cpus.size || s->numa_node >= 0) {
+        MT_LOG("Thread %p affinity is not supported", s);
+    }
+#endif
+
+    if (s->policy != MT_THREAD_INHERIT) {
+#ifdef _WIN32
+        if (!SetThreadPriority(GetCurrentThread(), s->priority)) {
+            MT_LOG("Thread %p failed to set priority %d", s, s->priority);
+        }
+#else
+        struct sched_param param;
+        int policy = s->policy == MT_THREAD_FIFO ? SCHED_FIFO
+                   : s->policy == MT_THREAD_ROUND_ROBIN ? SCHED_RR
+                   : SCHED_OTHER;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = policy == SCHED_OTHER ? 0 : s->priority;
+
+        if (pthread_setschedparam(pthread_self(), policy, &param)) {
+            MT_LOG("Thread %p failed to set scheduling %d/%d", s, policy, s->priority);
+        }
+#endif
+    }
+
+    dv_free(cpus);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -157,10 +361,15 @@ ThreadStart(void* arg)
         SetCurrentThreadName(s->name.data);
     }
 
+    ApplyThreadOptions(s);
+
     MT_SetCurrentMessageQueue(s->message_queue);
+    MTI_SET_THREAD_LOCAL(g_current_thread, s);
     exit_code = CALL_DELEGATE_0(s->start);
 
     MT_Emit(&s->on_exit, &exit_code);
+    MTI_ReleaseSignalEpoch();
+    MTI_SET_THREAD_LOCAL(g_current_thread, NULL);
 
 #ifdef _WIN32
     return (DWORD) exit_code;
@@ -199,11 +408,21 @@ void MT_StartThread(MT_Thread* s, IntDelegate call)
     s->started = true;
 
 #if defined _WIN32_WCE
-    s->thread = CreateThread(NULL, 0, &ThreadStart, s, 0, NULL);
+    s->thread = CreateThread(NULL, s->stack_size, &ThreadStart, s, 0, NULL);
 #elif defined _WIN32
-    s->thread = (MT_Handle) _beginthreadex(NULL, 0, &ThreadStart, s, 0, NULL);
+    s->thread = (MT_Handle) _beginthreadex(NULL, (unsigned) s->stack_size, &ThreadStart, s, 0, NULL);
 #else
-    pthread_create(&s->thread, NULL, &ThreadStart, s);
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+
+        if (s->stack_size && pthread_attr_setstacksize(&attr, s->stack_size)) {
+            MT_LOG("Thread %p failed to set stack size %d", s, (int) s->stack_size);
+        }
+
+        pthread_create(&s->thread, &attr, &ThreadStart, s);
+        pthread_attr_destroy(&attr);
+    }
 #endif
 }
 
@@ -36,6 +36,7 @@
 
 struct MT_Thread {
     MT_MessageQueue*    old_message_queue;
+    MT_Thread*          old_thread;
     MT_MessageQueue*    message_queue;
     IntDelegate         start;
     MT_Signal(int)      on_exit;
@@ -43,6 +44,13 @@ struct MT_Thread {
     bool                started;
     bool                joined;
 
+    /* Options applied when the thread starts */
+    size_t              stack_size;
+    d_Vector(int)       affinity;
+    MT_ThreadPolicy     policy;
+    int                 priority;
+    int                 numa_node;
+
 #ifdef _WIN32
     MT_Handle           thread;
 #else
@@ -54,6 +54,24 @@ MT_Time MT_CurrentTime()
 
 /* ------------------------------------------------------------------------- */
 
+MT_Time MT_MonotonicTime(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    MT_Time ret;
+
+    if (!clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        ret = MT_TIME_FROM_SECONDS(ts.tv_sec);
+        ret += MT_TIME_FROM_US(ts.tv_nsec / 1000);
+        return ret;
+    }
+#endif
+
+    return MT_CurrentTime();
+}
+
+/* ------------------------------------------------------------------------- */
+
 int MT_ToBrokenDownTime(MT_Time t, MT_BrokenDownTime* b)
 {
     struct tm tm;
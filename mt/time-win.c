@@ -86,6 +86,21 @@ MT_Time MT_CurrentTime()
 
 /* -------------------------------------------------------------------------- */
 
+MT_Time MT_MonotonicTime(void)
+{
+    LARGE_INTEGER freq, count;
+
+    if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&count)) {
+        return MT_CurrentTime();
+    }
+
+    /* Split the conversion to avoid overflowing the multiply */
+    return (MT_Time) ((count.QuadPart / freq.QuadPart) * INT64_C(1000000)
+                   + ((count.QuadPart % freq.QuadPart) * INT64_C(1000000)) / freq.QuadPart);
+}
+
+/* -------------------------------------------------------------------------- */
+
 int MT_ToBrokenDownTime(MT_Time t, MT_BrokenDownTime* tm)
 {
     FILETIME ft;